@@ -4,6 +4,7 @@
 #include "al/app/al_App.hpp"
 #include "al/math/al_Random.hpp"
 #include "al/ui/al_ControlGUI.hpp"  // gui.draw(g)
+#include "../fixed_step.hpp"
 
 using namespace al;
 
@@ -31,16 +32,22 @@ struct AlloApp : App {
   Parameter localRadius{"/localRadius", "", 0.4, "", 0.01, 0.9};
   Parameter size{"/size", "", 1.0, "", 0.0, 2.0};
   Parameter ratio{"/ratio", "", 1.0, "", 0.0, 2.0};
+  Parameter simRate{"/simRate", "", 60, "", 15, 240};
   ControlGUI gui;
 
+  // fixed-rate simulation clock
+  FixedStep clock;
+
   ShaderProgram shader;
   Mesh mesh;
 
   vector<Agent> agent;
+  // where each agent was at the previous step, for render interpolation
+  vector<Vec3f> previous;
 
   void onCreate() override {
     // add more GUI here
-    gui << moveRate << turnRate << localRadius << size << ratio;
+    gui << moveRate << turnRate << localRadius << size << ratio << simRate;
     gui.init();
     navControl().useMouse(false);
 
@@ -56,6 +63,7 @@ struct AlloApp : App {
       a.pos(rv());
       a.faceToward(rv());
       agent.push_back(a);
+      previous.push_back(a.pos());
       //
       mesh.vertex(a.pos());
       mesh.normal(a.uf());
@@ -66,7 +74,8 @@ struct AlloApp : App {
     nav().pos(0, 0, 10);
   }
 
-  void onAnimate(double dt) override {
+  // one fixed-length simulation step
+  void step() {
     // for each pair of agents
     //
     int N = agent.size();
@@ -138,9 +147,11 @@ struct AlloApp : App {
     // }
 
     // move the agents along (KEEP THIS CODE)
+    // moveRate is per 60 Hz frame, scaled to the step length
     //
     for (unsigned i = 0; i < N; i++) {
-      agent[i].pos() += agent[i].uf() * moveRate * 0.002;
+      previous[i] = agent[i].pos();
+      agent[i].pos() += agent[i].uf() * moveRate * 0.002 * (clock.step * 60);
     }
 
     // respawn agents if they go too far (MAYBE KEEP)
@@ -149,8 +160,17 @@ struct AlloApp : App {
       if (agent[i].pos().mag() > 1.1) {
         agent[i].pos(rv());
         agent[i].faceToward(rv());
+        previous[i] = agent[i].pos();
       }
     }
+  }
+
+  void onAnimate(double dt) override {
+    clock.rate(simRate);
+    int steps = clock.advance(dt);
+    for (int s = 0; s < steps; s++) step();
+    float alpha = clock.alpha();
+    int N = agent.size();
 
     // visualize the agents
     //
@@ -158,7 +178,7 @@ struct AlloApp : App {
     vector<Vec3f>& n(mesh.normals());
     vector<Color>& c(mesh.colors());
     for (unsigned i = 0; i < N; i++) {
-      v[i] = agent[i].pos();
+      v[i] = interpolate(previous[i], Vec3f(agent[i].pos()), alpha);
       n[i] = agent[i].uf();
       const Vec3d& up(agent[i].uu());
       c[i].set(up.x, up.y, up.z);
@@ -1,6 +1,7 @@
 #include "al/app/al_App.hpp"
 #include "al/math/al_Random.hpp"
 #include "al/ui/al_ControlGUI.hpp"  
+#include "../fixed_step.hpp"
 using namespace al;
 
 #include <fstream>
@@ -24,12 +25,18 @@ struct AlloApp : App {
   Parameter pointSize{"/pointSize", "", 4.0, "", 0.0, 5.0};
   Parameter timeStep{"/timeStep", "", 0.1, "", 0.01, 3.0};
   Parameter symmetry{"/symmetry", "", 1.0, "", 0.0, 1.0}; 
+  Parameter simRate{"/simRate", "", 60, "", 15, 240};
   ControlGUI gui;
 
   ShaderProgram pointShader;
   Mesh mesh;  
 
   vector<Vec3f> velocity;
+  // positions at the last two steps; the mesh shows a blend of the two
+  vector<Vec3f> previous;
+  vector<Vec3f> current;
+  // fixed-rate simulation clock
+  FixedStep clock;
   vector<Vec3f> acceleration;
   vector<Vec3f> gravitation;
   vector<float> mass;
@@ -42,6 +49,7 @@ struct AlloApp : App {
 
   void reset() {
     mesh.reset();
+    current.clear();
     velocity.clear();
     acceleration.clear();
 
@@ -74,7 +82,7 @@ struct AlloApp : App {
                            
   void onCreate() override {
 
-    gui << pointSize << timeStep << symmetry;
+    gui << pointSize << timeStep << symmetry << simRate;
     gui.init();
     navControl().useMouse(false);
 
@@ -89,11 +97,8 @@ struct AlloApp : App {
 
 
   bool pause = false;
-  void onAnimate(double dt) override {
-    if (pause) return;
-
-    dt = timeStep;
-
+  // one fixed-length simulation step of dt
+  void step(double dt) {
     // Gravitation
     for (int i = 0; i < mass.size(); i++){
       for (int k = i + 1; k < planetM.size(); k++){
@@ -134,6 +139,16 @@ struct AlloApp : App {
   }
 
 
+  void onAnimate(double dt) override {
+    if (pause) return;
+
+    // run the simulation at a fixed rate, timeStep of simulated time per
+    // step, no matter how long the frame took
+    clock.rate(simRate);
+    clock.advance(dt, mesh.vertices(), previous, current,
+                  [this] { step(timeStep); });
+  }
+
   bool onKeyDown(const Keyboard& k) override {
     if (k.key() == ' ') {
       pause = !pause;
@@ -2,9 +2,15 @@
 // created by Changzhi Cai at Fed 18th 2020
 
 #include "al/app/al_App.hpp"
-#include "al/math/al_Random.hpp"
 #include "al/ui/al_ControlGUI.hpp"  // gui.draw(g)
 #include "al_ext/statedistribution/al_CuttleboneStateSimulationDomain.hpp"
+#include "../counter_random.hpp"
+#include "../fixed_step.hpp"
+#include "../latency.hpp"
+#include "../profiler.hpp"
+#include "../snapshot_buffer.hpp"
+#include "../trace.hpp"
+#include "../wire_format.hpp"
 
 using namespace al;
 
@@ -12,11 +18,19 @@ using namespace al;
 #include <vector>
 using namespace std;
 
-// define the number of agents
-const int N = 1000;
+// define the number of agents; ./distributed-work --agents N
+unsigned N = 1000;
 
-Vec3f rv(float scale = 1.0f) {
-  return Vec3f(rnd::uniformS(), rnd::uniformS(), rnd::uniformS()) * scale;
+// seed for every random draw; ./distributed-work --seed S repeats a run
+uint64_t seed = 1;
+
+// what a random draw is for; with the agent and step it names the stream
+enum Purpose { PLACE, AIM, RESPAWN, RESPAWN_AIM };
+
+// a random point for one agent, the same no matter the order agents ask in
+Vec3f rv(unsigned id, uint32_t frame, Purpose purpose, float scale = 1.0f) {
+  CounterRandom r(seed, id, frame, purpose);
+  return Vec3f(r.uniformS(), r.uniformS(), r.uniformS()) * scale;
 }
 
 string slurp(string fileName);  // forward declaration
@@ -29,20 +43,32 @@ struct Agent : Pose {
 };
 
 // define the array of agents
-Agent agents[N];
-
-// agent attributes for future use
-struct AgentAttribute{
-  Vec3f position;
-  Vec3f forward;
-  Vec3f up;
-};
+vector<Agent> agents;
+// where each agent was at the previous step, for render interpolation
+vector<Vec3f> previous;
+
+// agents are shipped as quantized poses (10 bytes instead of 36);
+// respawns keep them inside these bounds
+const WorldBounds worldBounds;
+
+// Cuttlebone needs a fixed-size state and sends all of it every frame, so
+// it only has room for MAX_AGENTS agents, chosen when building: by default
+// what Cuttlebone carries comfortably (about 80 KB a frame), so --agents
+// can go well past the default N. only the first count are meaningful
+#ifndef MAX_AGENTS
+#define MAX_AGENTS 8192
+#endif
+const unsigned maxAgents = MAX_AGENTS;
 
 // define the SharedState structure
 struct SharedState{
-  AgentAttribute agents[N];
+  StateStamp stamp;  // which state this is and when it was sent
+  double time;       // simulated seconds the poses are for
+  uint32_t count;
   float size;
   float ratio;
+  float delay;       // renderers draw this far behind the newest state
+  PackedPose agents[maxAgents];
 };
 
 class MyApp : public DistributedAppWithState<SharedState> {
@@ -52,8 +78,30 @@ class MyApp : public DistributedAppWithState<SharedState> {
   Parameter localRadius{"/localRadius", "", 0.4, "", 0.01, 0.9};
   Parameter size{"/size", "", 1.0, "", 0.0, 2.0};
   Parameter ratio{"/ratio", "", 1.0, "", 0.0, 2.0};
+  Parameter simRate{"/simRate", "", 60, "", 15, 240};
+  // states published per second, and how far behind the newest one
+  // renderers draw
+  Parameter publishRate{"/publishRate", "", 60, "", 5, 120};
+  Parameter drawDelay{"/drawDelay", "", 0.05, "", 0.0, 0.1};
   ControlGUI gui;
 
+  // fixed-rate simulation clock
+  FixedStep clock;
+  uint32_t tick = 0;  // steps taken
+  double simTime = 0;  // simulated seconds, at the last step
+  double sincePublish = 0;  // real seconds since the last state went out
+
+  // where the frame goes; 'p' writes profile.csv
+  Profiler profiler;
+  unsigned frameStage, stepStage, distributeStage, visualizeStage, drawStage;
+  // the same spans on a timeline; 't' writes trace.json
+  TraceRecorder trace;
+  // how old the drawn state is, and how many states were missed or drawn
+  // twice
+  LatencyMonitor latency;
+  // the last few states, drawn a little behind the newest and blended
+  SnapshotBuffer snapshots;
+
   // You can keep a pointer to the cuttlebone domain
   // This can be useful to ask the domain if it is a sender or receiver
   std::shared_ptr<CuttleboneStateSimulationDomain<SharedState>>
@@ -73,22 +121,39 @@ class MyApp : public DistributedAppWithState<SharedState> {
     }
 
     // add more GUI here
-    gui << moveRate << turnRate << localRadius << size << ratio;
-    gui.init();
+    gui << moveRate << turnRate << localRadius << size << ratio << simRate
+        << publishRate << drawDelay;
+    // onDraw runs the ImGui frame, so the stats panels share it with the
+    // parameters
+    imguiInit();
+    gui.init(5, 5, false);
     navControl().useMouse(false);
 
+    frameStage = profiler.stage("frame");
+    stepStage = profiler.stage("step");
+    distributeStage = profiler.stage("distribute");
+    visualizeStage = profiler.stage("visualize");
+    drawStage = profiler.stage("draw");
+
     // compile shaders
-    shader.compile(slurp("../tetrahedron-vertex.glsl"),
-                   slurp("../tetrahedron-fragment.glsl"),
-                   slurp("../tetrahedron-geometry.glsl"));
+    trace.nameThread("main");
+    {
+      TraceScope span(trace, "compileShaders");
+      shader.compile(slurp("../tetrahedron-vertex.glsl"),
+                     slurp("../tetrahedron-fragment.glsl"),
+                     slurp("../tetrahedron-geometry.glsl"));
+    }
 
     mesh.primitive(Mesh::POINTS);
 
-    for (int _ = 0; _ < 1000; _++) {
+    agents.resize(N);
+    previous.resize(N);
+    for (unsigned _ = 0; _ < N; _++) {
       Agent a;
-      a.pos(rv());
-      a.faceToward(rv());
+      a.pos(rv(_, 0, PLACE));
+      a.faceToward(rv(_, 0, AIM));
       agents[_] = a;
+      previous[_] = a.pos();
       mesh.vertex(a.pos());
       mesh.normal(a.uf());
       const Vec3f& up(a.uu());
@@ -98,7 +163,8 @@ class MyApp : public DistributedAppWithState<SharedState> {
     nav().pos(0, 0, 10);
   }
 
-  void onAnimate(double dt) override {
+  // one fixed-length simulation step
+  void step() {
     Vec3f steer(0, 0, 0);
     Vec3f diff(0, 0, 0);
     Vec3f center(0, 0, 0);
@@ -106,8 +172,6 @@ class MyApp : public DistributedAppWithState<SharedState> {
     int countx = 0;
     int county = 0;
     int countz = 0;
-    if (cuttleboneDomain->isSender()) {
-
     // code is here
     //
     // separation: steer to avoid crowding local flockmates
@@ -165,47 +229,91 @@ class MyApp : public DistributedAppWithState<SharedState> {
     // }
 
     // move the agents along (KEEP THIS CODE)
+    // moveRate is per 60 Hz frame, scaled to the step length
     //
     for (unsigned i = 0; i < N; i++) {
-      agents[i].pos() += agents[i].uf() * moveRate * 0.002;
+      previous[i] = agents[i].pos();
+      agents[i].pos() += agents[i].uf() * moveRate * 0.002 * (clock.step * 60);
     }
 
     // respawn agents if they go too far (MAYBE KEEP)
     //
     for (unsigned i = 0; i < N; i++) {
       if (agents[i].pos().mag() > 1.1) {
-        agents[i].pos(rv());
-        agents[i].faceToward(rv());
+        agents[i].pos(rv(i, tick, RESPAWN));
+        agents[i].faceToward(rv(i, tick, RESPAWN_AIM));
+        previous[i] = agents[i].pos();
       }
     }
+    tick++;
+  }
+
+  void onAnimate(double dt) override {
+    profiler.endFrame();  // the previous frame, draw included
+    profiler.add(frameStage, dt);
+    if (cuttleboneDomain->isSender()) {
+    clock.rate(simRate);
+    int steps = clock.advance(dt);
+    for (int s = 0; s < steps; s++) {
+      ProfileScope scope(profiler, stepStage);
+      TraceScope span(trace, "step");
+      step();
+      simTime += clock.step;
+    }
+    float alpha = clock.alpha();
 
     // change it to Distributed array
-    for (unsigned i = 0; i < N; i++) { 
-        AgentAttribute a;
-        a.position = agents[i].pos();
-        a.forward = agents[i].uf();
-        a.up = agents[i].uu();
-        state().agents[i] = a;
+    // (the first frame past each 1 / publishRate; in between, receivers
+    // blend the states they have)
+    sincePublish += dt;
+    if (sincePublish * publishRate >= 1) {
+      sincePublish = fmod(sincePublish, 1 / publishRate.get());
+      ProfileScope scope(profiler, distributeStage);
+      TraceScope span(trace, "distribute");
+      for (unsigned i = 0; i < N; i++) { 
+        Vec3f position = interpolate(previous[i], Vec3f(agents[i].pos()), alpha);
+        state().agents[i] = packPose(position, agents[i].quat(), worldBounds);
       }
+      state().time = simTime - (1 - alpha) * clock.step;
+      state().count = N;
       state().size = size.get();
       state().ratio = ratio.get();
+      state().delay = drawDelay.get();
+      latency.stamp(state().stamp);
+    }
     }
     else{ }
 
     // visualize the agents
-    //
-    vector<Vec3f>& v(mesh.vertices());
-    vector<Vec3f>& n(mesh.normals());
-    vector<Color>& c(mesh.colors());
-    for (unsigned i = 0; i < N; i++) {
-      v[i] = state().agents[i].position;
-      n[i] = state().agents[i].forward;
-      const Vec3d& up(state().agents[i].up);
-      c[i].set(up.x, up.y, up.z);
+    // (a receiver sizes its mesh from what the sender ships)
+    ProfileScope scope(profiler, visualizeStage);
+    TraceScope span(trace, "visualize");
+    unsigned count = min(unsigned(state().count), maxAgents);
+    if (!snapshots.holds(state().time)) {
+      SnapshotBuffer::Snapshot& s =
+          snapshots[snapshots.push(state().time, 0, count)];
+      for (unsigned i = 0; i < count; i++) {
+        s.position[i] = unpackPosition(state().agents[i], worldBounds);
+        s.orientation[i] = unpackOrientation(state().agents[i]);
+      }
+    }
+    snapshots.delay = state().delay;
+    snapshots.advance(dt);
+    latency.receive(state().stamp, profiler, snapshots.behind());
+    if (mesh.vertices().size() != count) {
+      mesh.reset();
+      for (unsigned i = 0; i < count; i++) {
+        mesh.vertex(Vec3f(0, 0, 0));
+        mesh.normal(Vec3f(0, 0, -1));
+        mesh.color(0, 1, 0);
+      }
     }
+    snapshots.draw(0, count, mesh, 0);
   }
 
   void onDraw(Graphics& g) override {
+    ProfileScope scope(profiler, drawStage);
+    TraceScope span(trace, "draw");
     g.clear(0.1, 0.1, 0.1);
     gl::depthTest(true); // or g.depthTesting(true);
     gl::blending(true); // or g.blending(true);
@@ -216,12 +324,44 @@ class MyApp : public DistributedAppWithState<SharedState> {
     g.draw(mesh);
 
     if (isPrimary()) {
+      imguiBeginFrame();
       gui.draw(g);
+      gui.begin();
+      profiler.drawPanel();
+      latency.drawPanel();
+      snapshots.drawPanel();
+      gui.end();
+      imguiEndFrame();
+      imguiDraw();
     }
   }
+
+  bool onKeyDown(const Keyboard& k) override {
+    if (k.key() == 'p') {
+      if (profiler.writeCSV("profile.csv"))
+        std::cout << "wrote profile.csv" << std::endl;
+    }
+    if (k.key() == 't') {
+      if (trace.writeJSON("trace.json"))
+        std::cout << "wrote trace.json" << std::endl;
+    }
+    return true;
+  }
 };
 
-int main() {
+int main(int argc, char* argv[]) {
+  for (int i = 1; i + 1 < argc; i++) {
+    if (string(argv[i]) == "--agents") N = unsigned(atoi(argv[++i]));
+    else if (string(argv[i]) == "--seed") seed = strtoull(argv[++i], 0, 10);
+  }
+  if (N > maxAgents) {
+    std::cerr << "ERROR: SharedState holds " << maxAgents
+              << " agents (build with -DMAX_AGENTS=N for more). Quitting."
+              << std::endl;
+    std::cerr << "usage: " << argv[0] << " [--agents N] [--seed S]; this "
+              << "build takes up to " << maxAgents << " agents" << std::endl;
+    return 1;
+  }
   MyApp app;
   app.start();
 }
@@ -0,0 +1,68 @@
+// MAT201B
+// counter-based random numbers for reproducible parallel updates
+//
+// every stream is named by (seed, agent id, frame, purpose) and its n-th
+// number is a pure function of that name and n, so it does not matter which
+// thread draws it or in what order: a parallel run matches a serial one bit
+// for bit. the generator is Philox4x32-10 (Salmon et al. 2011):
+//
+//   CounterRandom r(seed, id, frame, RESPAWN);
+//   Vec3f p(r.uniformS(), r.uniformS(), r.uniformS());
+
+#pragma once
+
+#include <cstdint>
+
+// ten rounds of Philox4x32 over `counter`, keyed by `key`
+inline void philox4x32(uint32_t counter[4], const uint32_t key[2]) {
+  uint32_t k0 = key[0], k1 = key[1];
+  for (int round = 0; round < 10; round++) {
+    uint64_t p0 = uint64_t(0xD2511F53u) * counter[0];
+    uint64_t p1 = uint64_t(0xCD9E8D57u) * counter[2];
+    uint32_t c0 = uint32_t(p1 >> 32) ^ counter[1] ^ k0;
+    uint32_t c1 = uint32_t(p1);
+    uint32_t c2 = uint32_t(p0 >> 32) ^ counter[3] ^ k1;
+    uint32_t c3 = uint32_t(p0);
+    counter[0] = c0;
+    counter[1] = c1;
+    counter[2] = c2;
+    counter[3] = c3;
+    k0 += 0x9E3779B9u;
+    k1 += 0xBB67AE85u;
+  }
+}
+
+class CounterRandom {
+ public:
+  CounterRandom(uint64_t seed, uint32_t id, uint32_t frame, uint32_t purpose)
+      : id(id), frame(frame), purpose(purpose) {
+    key[0] = uint32_t(seed);
+    key[1] = uint32_t(seed >> 32);
+  }
+
+  // the next 32 random bits of the stream
+  uint32_t next() {
+    if (used == 4) {
+      block[0] = id;
+      block[1] = frame;
+      block[2] = purpose;
+      block[3] = draws++;
+      philox4x32(block, key);
+      used = 0;
+    }
+    return block[used++];
+  }
+
+  // [0, 1) with the 24 bits a float can hold
+  float uniform() { return (next() >> 8) * (1.0f / 16777216.0f); }
+
+  // [-1, 1)
+  float uniformS() { return uniform() * 2.0f - 1.0f; }
+
+ private:
+  uint32_t key[2];
+  uint32_t id, frame, purpose;
+  uint32_t draws{0};
+  uint32_t block[4];
+  int used{4};
+};
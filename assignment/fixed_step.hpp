@@ -0,0 +1,79 @@
+// MAT201B
+// fixed-rate simulation clock shared by the apps in this folder
+//
+// onAnimate hands the real frame time to advance(), runs the simulation
+// that many times at a fixed step, then draws the state blended
+// alpha() of the way from the previous step to the current one:
+//
+//   int steps = clock.advance(dt);
+//   for (int s = 0; s < steps; s++) { previous = current; simulate(); }
+//   draw(interpolate(previous, current, clock.alpha()));
+//
+// apps that simulate on the positions they draw (the particle apps) hand
+// the whole frame to the overload that does this to a vector in place.
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+struct FixedStep {
+  double step{1.0 / 60};  // seconds of simulated time per step
+  int maxSteps{4};        // cap per frame so a slow frame cannot snowball
+  double accumulator{0};
+  unsigned long steps{0};  // steps taken since start
+  unsigned long dropped{0};  // steps skipped because of the cap
+
+  void rate(double hz) { step = 1.0 / hz; }
+
+  // how many steps to run for a frame that took `dt` seconds
+  int advance(double dt) {
+    accumulator += dt;
+    int n = int(accumulator / step);
+    if (n > maxSteps) {
+      dropped += n - maxSteps;
+      n = maxSteps;
+      accumulator = std::fmod(accumulator, step);
+    } else {
+      accumulator -= n * step;
+    }
+    steps += n;
+    return n;
+  }
+
+  // how far past the last step the frame is drawn, in [0, 1)
+  float alpha() const { return float(accumulator / step); }
+
+  // run the frame's steps (simulate() each) on `shown` from the positions
+  // of the last step, keep the last two steps in previous and current,
+  // then leave `shown` blended alpha() of the way between them. an empty
+  // `current` (after a reset) starts over from `shown`
+  template <typename V, typename Simulate>
+  void advance(double dt, std::vector<V>& shown, std::vector<V>& previous,
+               std::vector<V>& current, Simulate simulate);
+};
+
+// blend a value between the previous and the current step
+template <typename V>
+V interpolate(const V& previous, const V& current, float alpha) {
+  return previous + (current - previous) * alpha;
+}
+
+template <typename V, typename Simulate>
+void FixedStep::advance(double dt, std::vector<V>& shown,
+                        std::vector<V>& previous, std::vector<V>& current,
+                        Simulate simulate) {
+  if (current.size() != shown.size()) previous = current = shown;
+  int n = advance(dt);
+  if (n > 0) shown = current;
+  for (int s = 0; s < n; s++) {
+    previous = shown;
+    simulate();
+  }
+  if (n > 0) current = shown;
+
+  float a = alpha();
+  for (size_t i = 0; i < shown.size(); i++)
+    shown[i] = interpolate(previous[i], current[i], a);
+}
@@ -0,0 +1,81 @@
+// MAT201B
+// how stale the state a renderer draws is
+//
+// the sender stamps every state it publishes with a sequence number and
+// the wall-clock time; each renderer checks the stamp of the newest state
+// once its snapshot buffer has moved on, and adds how far behind that the
+// poses it draws are:
+//
+//   latency.stamp(state().stamp);              // sender, after publishing
+//   snapshots.advance(dt);                     // everyone, then
+//   latency.receive(state().stamp, profiler, snapshots.behind());
+//   gui.begin(); latency.drawPanel(); gui.end();  // as in profiler.hpp
+//
+// ages across machines are only as good as their clock sync (NTP/PTP);
+// the sequence counts do not depend on it.
+
+#pragma once
+
+#include "al/io/al_Imgui.hpp"
+#include "profiler.hpp"
+
+#include <chrono>
+#include <cstdint>
+
+struct StateStamp {
+  uint32_t sequence;   // states published so far
+  int64_t sentMicros;  // wall clock when it was published
+};
+
+inline int64_t wallMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+class LatencyMonitor {
+ public:
+  // sender side
+  void stamp(StateStamp& s) {
+    s.sequence = ++published;
+    s.sentMicros = wallMicros();
+  }
+
+  // receiver side, once per rendered frame. behind is how many seconds
+  // the drawn poses trail the stamped state (the playback delay). the age
+  // goes into the profiler's "stateAge" row (in place of a duration) so it
+  // gets the same rolling min/mean/p99, histogram and CSV column as the
+  // stages
+  void receive(const StateStamp& s, Profiler& profiler, double behind = 0) {
+    if (s.sequence == 0) return;  // nothing published yet
+    if (!started) {
+      ageStage = profiler.stage("stateAge");
+      started = true;
+    } else if (s.sequence == last) {
+      duplicated++;
+    } else {
+      uint32_t gap = s.sequence - last;  // wraps correctly
+      if (gap > 1 && gap < 0x80000000u) dropped += gap - 1;
+    }
+    if (s.sequence != last) fresh++;
+    last = s.sequence;
+    age = (wallMicros() - s.sentMicros) * 1e-6 + behind;
+    profiler.add(ageStage, age);
+  }
+
+  void drawPanel() {
+    if (!ImGui::CollapsingHeader("latency")) return;
+    ImGui::Text("state %u, age %.2f ms", last, age * 1e3);
+    ImGui::Text("%lu new, %lu duplicated, %lu dropped", fresh, duplicated,
+                dropped);
+  }
+
+  uint32_t published{0};  // sender
+  uint32_t last{0};       // newest sequence seen
+  double age{0};          // seconds, of the poses drawn last
+  unsigned long fresh{0}, duplicated{0}, dropped{0};
+
+ private:
+  bool started{false};
+  unsigned ageStage{0};
+};
@@ -1,6 +1,8 @@
 #include "al/app/al_App.hpp"
 #include "al/math/al_Random.hpp"
 #include "al/ui/al_ControlGUI.hpp"  // gui.draw(g)
+#include "fixed_step.hpp"
+#include "profiler.hpp"
 
 using namespace al;
 
@@ -17,6 +19,7 @@ struct AlloApp : App {
   Parameter dragFactor{"/dragFactor", "", 0.1, "", 0.01, 0.99};
   Parameter maxAccel{"/maxAccel", "", 1.0, "", 0.01, 7.0};  // ??
   // add more GUI here
+  Parameter simRate{"/simRate", "", 60, "", 15, 240};
   ControlGUI gui;
 
   ShaderProgram pointShader;
@@ -24,15 +27,30 @@ struct AlloApp : App {
 
   // simulation state
   vector<Vec3f> velocity;
+  // positions at the last two steps; the mesh shows a blend of the two
+  vector<Vec3f> previous;
+  vector<Vec3f> current;
+  // fixed-rate simulation clock
+  FixedStep clock;
+  // where the frame goes; 'p' writes profile.csv
+  Profiler profiler;
+  unsigned frameStage, stepStage, drawStage;
   vector<Vec3f> acceleration;
   vector<float> mass;
 
   void onCreate() override {
-    gui << pointSize << timeStep << gravConst << dragFactor << maxAccel;
+    gui << pointSize << timeStep << gravConst << dragFactor << maxAccel << simRate;
     // add more GUI here
-    gui.init();
+    // onDraw runs the ImGui frame, so the stats panels share it with the
+    // parameters
+    imguiInit();
+    gui.init(5, 5, false);
     navControl().useMouse(false);
 
+    frameStage = profiler.stage("frame");
+    stepStage = profiler.stage("step");
+    drawStage = profiler.stage("draw");
+
     pointShader.compile(slurp("../point-vertex.glsl"),
                         slurp("../point-fragment.glsl"),
                         slurp("../point-geometry.glsl"));
@@ -47,6 +65,7 @@ struct AlloApp : App {
   void reset() {
     // empty all containers
     mesh.reset();
+    current.clear();
     velocity.clear();
     acceleration.clear();
 
@@ -108,12 +127,8 @@ struct AlloApp : App {
   float biggestEver{0};
 
   bool freeze = false;
-  void onAnimate(double dt) override {
-    if (freeze) return;
-
-    // ignore the real dt and set the time step;
-    dt = timeStep;
-
+  // one fixed-length simulation step of dt
+  void step(double dt) {
     {
       const vector<Vec3f>& position(mesh.vertices());
       for (int i = 0; i < position.size(); i++) {
@@ -164,6 +179,20 @@ struct AlloApp : App {
     for (auto& a : acceleration) a.zero();
   }
 
+  void onAnimate(double dt) override {
+    profiler.endFrame();  // the previous frame, draw included
+    profiler.add(frameStage, dt);
+    if (freeze) return;
+
+    // run the simulation at a fixed rate, timeStep of simulated time per
+    // step, no matter how long the frame took
+    clock.rate(simRate);
+    clock.advance(dt, mesh.vertices(), previous, current, [this] {
+      ProfileScope scope(profiler, stepStage);
+      step(timeStep);
+    });
+  }
+
   bool onKeyDown(const Keyboard& k) override {
     if (k.key() == ' ') {
       freeze = !freeze;
@@ -174,10 +203,15 @@ struct AlloApp : App {
       reset();
     }
 
+    if (k.key() == 'p') {
+      if (profiler.writeCSV("profile.csv")) cout << "wrote profile.csv" << endl;
+    }
+
     return true;
   }
 
   void onDraw(Graphics& g) override {
+    ProfileScope scope(profiler, drawStage);
     g.clear(0.3);
     g.shader(pointShader);
     g.shader().uniform("pointSize", pointSize / 100);
@@ -185,7 +219,13 @@ struct AlloApp : App {
     g.blendModeTrans();
     g.depthTesting(true);
     g.draw(mesh);
+    imguiBeginFrame();
     gui.draw(g);
+    gui.begin();
+    profiler.drawPanel();
+    gui.end();
+    imguiEndFrame();
+    imguiDraw();
   }
 };
 
@@ -1,6 +1,7 @@
 #include "al/app/al_App.hpp"
 #include "al/math/al_Random.hpp"
 #include "al/ui/al_ControlGUI.hpp"  // gui.draw(g)
+#include "fixed_step.hpp"
 
 using namespace al;
 
@@ -19,6 +20,7 @@ struct AlloApp : App {
   // add new GUI to adjust the symmetry from 0.0 - 2.0
   Parameter symmetry{"/symmetry", "", 1.0, "", 0.0, 2.0};
   // add more GUI here
+  Parameter simRate{"/simRate", "", 60, "", 15, 240};
   ControlGUI gui;
 
   ShaderProgram pointShader;
@@ -26,11 +28,16 @@ struct AlloApp : App {
 
   // simulation state
   vector<Vec3f> velocity;
+  // positions at the last two steps; the mesh shows a blend of the two
+  vector<Vec3f> previous;
+  vector<Vec3f> current;
+  // fixed-rate simulation clock
+  FixedStep clock;
   vector<Vec3f> acceleration;
   vector<float> mass;
 
   void onCreate() override {
-    gui << pointSize << timeStep << gravConst << dragFactor << maxAccel << symmetry;
+    gui << pointSize << timeStep << gravConst << dragFactor << maxAccel << symmetry << simRate;
     // add more GUI here
     gui.init();
     navControl().useMouse(false);
@@ -49,6 +56,7 @@ struct AlloApp : App {
   void reset() {
     // empty all containers
     mesh.reset();
+    current.clear();
     velocity.clear();
     acceleration.clear();
 
@@ -110,12 +118,8 @@ struct AlloApp : App {
   float biggestEver{0};
 
   bool freeze = false;
-  void onAnimate(double dt) override {
-    if (freeze) return;
-
-    // ignore the real dt and set the time step;
-    dt = timeStep;
-
+  // one fixed-length simulation step of dt
+  void step(double dt) {
     {
       const vector<Vec3f>& position(mesh.vertices());
       for (int i = 0; i < position.size(); i++) {
@@ -166,6 +170,16 @@ struct AlloApp : App {
     for (auto& a : acceleration) a.zero();
   }
 
+  void onAnimate(double dt) override {
+    if (freeze) return;
+
+    // run the simulation at a fixed rate, timeStep of simulated time per
+    // step, no matter how long the frame took
+    clock.rate(simRate);
+    clock.advance(dt, mesh.vertices(), previous, current,
+                  [this] { step(timeStep); });
+  }
+
   bool onKeyDown(const Keyboard& k) override {
     if (k.key() == ' ') {
       freeze = !freeze;
@@ -0,0 +1,159 @@
+// MAT201B
+// per-stage frame profiler shared by the apps in this folder
+//
+// stages are named once, timed with a scope (or handed a duration), and
+// every frame the time each stage took goes into a rolling window. the
+// window's min/mean/p99 are drawn inside the ControlGUI and can be written
+// out as CSV:
+//
+//   unsigned drawStage = profiler.stage("draw");
+//   { ProfileScope scope(profiler, drawStage); ... }
+//   profiler.endFrame();
+//   profiler.writeCSV("profile.csv");
+//
+// the panel goes in the same ImGui frame as the parameters, so the app runs
+// that frame itself (gui.init(5, 5, false) after imguiInit()):
+//
+//   imguiBeginFrame();
+//   gui.draw(g);
+//   gui.begin(); profiler.drawPanel(); gui.end();
+//   imguiEndFrame(); imguiDraw();
+//
+// a scope costs two clock reads; the statistics are only sorted a few
+// times a second, so the whole thing stays far below 1% of a frame.
+
+#pragma once
+
+#include "al/io/al_Imgui.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class Profiler {
+ public:
+  enum { WINDOW = 240 };    // frames of history per stage
+  enum { REFRESH = 15 };    // frames between recomputing the statistics
+
+  struct Stats {
+    float min{0}, mean{0}, p99{0};  // over the window, in ms
+  };
+
+  // id of the stage called `name`, registering it the first time
+  unsigned stage(const std::string& name) {
+    for (unsigned i = 0; i < stages.size(); i++)
+      if (stages[i].name == name) return i;
+    stages.emplace_back();
+    stages.back().name = name;
+    return unsigned(stages.size() - 1);
+  }
+
+  // time spent in a stage this frame; a stage may be added to many times
+  void add(unsigned id, double seconds) {
+    Stage& s = stages[id];
+    s.frame += seconds;
+    s.ran = true;
+  }
+
+  // close the frame: stages that ran push their time into their window
+  void endFrame() {
+    for (Stage& s : stages) {
+      if (!s.ran) continue;
+      s.window[s.head] = float(s.frame * 1e3);
+      s.head = (s.head + 1) % WINDOW;
+      s.count = std::min(s.count + 1, unsigned(WINDOW));
+      s.total += s.frame;
+      s.frames++;
+      s.frame = 0;
+      s.ran = false;
+    }
+    if (++sinceRefresh >= REFRESH) refresh();
+  }
+
+  const Stats& stats(unsigned id) const { return stages[id].stats; }
+
+  // one row per stage with a histogram of its window
+  void drawPanel() {
+    if (!ImGui::CollapsingHeader("profiler (ms: min / mean / p99)")) return;
+    char overlay[96];
+    for (const Stage& s : stages) {
+      if (s.count == 0) continue;
+      snprintf(overlay, sizeof(overlay), "%s  %.3f / %.3f / %.3f",
+               s.name.c_str(), s.stats.min, s.stats.mean, s.stats.p99);
+      ImGui::PlotHistogram(("##" + s.name).c_str(), s.window, WINDOW,
+                           int(s.head), overlay, 0.0f,
+                           std::max(s.stats.p99 * 1.25f, 1e-3f),
+                           ImVec2(0, 28));
+    }
+  }
+
+  bool writeCSV(const char* fileName) {
+    refresh();
+    FILE* file = fopen(fileName, "w");
+    if (!file) return false;
+    fprintf(file, "stage,frames,min_ms,mean_ms,p99_ms,total_ms\n");
+    for (const Stage& s : stages)
+      fprintf(file, "%s,%lu,%.4f,%.4f,%.4f,%.3f\n", s.name.c_str(), s.frames,
+              s.stats.min, s.stats.mean, s.stats.p99, s.total * 1e3);
+    fclose(file);
+    return true;
+  }
+
+ private:
+  struct Stage {
+    std::string name;
+    float window[WINDOW] = {};
+    unsigned head{0};
+    unsigned count{0};
+    double frame{0};   // seconds so far this frame
+    bool ran{false};
+    double total{0};   // seconds over the whole run
+    unsigned long frames{0};
+    Stats stats;
+  };
+
+  void refresh() {
+    sinceRefresh = 0;
+    for (Stage& s : stages) {
+      if (s.count == 0) continue;
+      // oldest first; until the window fills only the newest count are
+      // real samples
+      sorted.assign(s.window, s.window + WINDOW);
+      std::rotate(sorted.begin(), sorted.begin() + s.head, sorted.end());
+      std::vector<float>::iterator first = sorted.end() - s.count;
+      std::sort(first, sorted.end());
+      double sum = 0;
+      for (std::vector<float>::iterator v = first; v != sorted.end(); v++)
+        sum += *v;
+      s.stats.min = *first;
+      s.stats.mean = float(sum / s.count);
+      // nearest rank
+      unsigned rank = unsigned(std::ceil(0.99 * s.count));
+      s.stats.p99 = first[std::max(rank, 1u) - 1];
+    }
+  }
+
+  std::vector<Stage> stages;
+  std::vector<float> sorted;  // scratch for the percentiles
+  unsigned sinceRefresh{0};
+};
+
+// adds the time from construction to destruction to a stage
+class ProfileScope {
+ public:
+  ProfileScope(Profiler& profiler, unsigned id)
+      : profiler(profiler), id(id), start(std::chrono::steady_clock::now()) {}
+  ~ProfileScope() {
+    profiler.add(id, std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count());
+  }
+
+ private:
+  Profiler& profiler;
+  unsigned id;
+  std::chrono::steady_clock::time_point start;
+};
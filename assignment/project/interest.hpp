@@ -0,0 +1,158 @@
+// MAT201B final project
+// interest management: which parts of SharedState a renderer decodes
+//
+// each projector only shows part of the world, so the sender keeps agents
+// that are close in space close in the arrays (sortSpecies, every so many
+// steps) and publishes them in blocks of BLOCK agents, each with the box
+// its poses fall in. a renderer is started with the region it shows,
+//
+//   ./project --view 0,0,0.5,1,1,1
+//
+// and decodes and uploads only the blocks whose box meets that region.
+// the agents are only sorted when the state goes out through --stream or
+// --shm. Cuttlebone sends all of SharedState, so there they stay in order,
+// every block spans the whole cube and --view culls nothing.
+
+#pragma once
+
+#include "species.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// agents per block of the shared state
+enum { BLOCK = 1024 };
+
+inline unsigned blocksFor(unsigned count) {
+  return (count + BLOCK - 1) / BLOCK;
+}
+
+// agents in block b; the last one may be short
+inline unsigned blockLength(unsigned count, unsigned b) {
+  return std::min(count - b * BLOCK, unsigned(BLOCK));
+}
+
+// a box in the same fixed point as PackedPose::position
+struct BlockBounds {
+  uint16_t lo[3];
+  uint16_t hi[3];
+};
+
+// the box around every position
+const BlockBounds wholeWorld{{0, 0, 0}, {65535, 65535, 65535}};
+
+// the part of the world a renderer draws; all of it unless set
+struct ViewRegion {
+  BlockBounds box = wholeWorld;
+
+  // "x0,y0,z0,x1,y1,z1", a box in the coordinates agents live in (the
+  // unit cube). a region that reaches past a face of the cube should be
+  // given as the whole axis, since blocks do not wrap
+  bool parse(const char* text, const WorldBounds& bounds) {
+    float v[6];
+    if (sscanf(text, "%f,%f,%f,%f,%f,%f", v, v + 1, v + 2, v + 3, v + 4,
+               v + 5) != 6)
+      return false;
+    for (int a = 0; a < 3; a++) {
+      box.lo[a] = quantize(std::min(v[a], v[a + 3]), bounds.lo, bounds.hi);
+      box.hi[a] = quantize(std::max(v[a], v[a + 3]), bounds.lo, bounds.hi);
+    }
+    return true;
+  }
+
+  bool all() const {
+    for (int a = 0; a < 3; a++)
+      if (box.lo[a] != 0 || box.hi[a] != 65535) return false;
+    return true;
+  }
+
+  bool sees(const BlockBounds& block) const {
+    for (int a = 0; a < 3; a++)
+      if (block.hi[a] < box.lo[a] || box.hi[a] < block.lo[a]) return false;
+    return true;
+  }
+};
+
+// renumber agents along a Morton curve through a 16^3 grid over the cube,
+// so each BLOCK of consecutive agents covers a small box. the sort is
+// stable, so the result only depends on positions. order is scratch kept
+// by the caller; anything holding agent ids (the grid, neighbour lists)
+// must be rebuilt afterwards
+template <typename T>
+void sortSpecies(Species<T>& s, std::vector<unsigned>& order,
+                 std::vector<unsigned>& keys) {
+  enum { BITS = 4, SIDE = 1 << BITS, CELLS = SIDE * SIDE * SIDE };
+  auto axis = [](T x) {
+    int c = int(std::floor(x * SIDE)) % SIDE;
+    return unsigned(c < 0 ? c + SIDE : c);
+  };
+  // spread 4 bits out to every third bit
+  auto spread = [](unsigned c) {
+    return (c & 1) | (c & 2) << 2 | (c & 4) << 4 | (c & 8) << 6;
+  };
+  keys.resize(s.n);
+  unsigned start[CELLS + 1] = {};
+  for (unsigned i = 0; i < s.n; i++) {
+    keys[i] = spread(axis(s.px[i])) | spread(axis(s.py[i])) << 1 |
+              spread(axis(s.pz[i])) << 2;
+    start[keys[i] + 1]++;
+  }
+  for (unsigned c = 0; c < CELLS; c++) start[c + 1] += start[c];
+  order.resize(s.n);
+  for (unsigned i = 0; i < s.n; i++) order[start[keys[i]]++] = i;
+  s.permute(order);
+}
+
+// the box around blocks [begin, end) of a species' published poses,
+// widened by margin for receivers that draw them a little off
+inline void boundBlocks(const PackedPose* in, unsigned count,
+                        BlockBounds* out, uint16_t margin = 0,
+                        unsigned begin = 0, unsigned end = ~0u) {
+  end = std::min(end, blocksFor(count));
+  for (unsigned b = begin; b < end; b++) {
+    BlockBounds box{{65535, 65535, 65535}, {0, 0, 0}};
+    unsigned last = b * BLOCK + blockLength(count, b);
+    for (unsigned i = b * BLOCK; i < last; i++)
+      for (int a = 0; a < 3; a++) {
+        box.lo[a] = std::min(box.lo[a], in[i].position[a]);
+        box.hi[a] = std::max(box.hi[a], in[i].position[a]);
+      }
+    for (int a = 0; a < 3; a++) {
+      box.lo[a] = uint16_t(std::max(0, box.lo[a] - margin));
+      box.hi[a] = uint16_t(std::min(65535, box.hi[a] + margin));
+    }
+    out[b] = box;
+  }
+}
+
+// the box around both
+inline BlockBounds unionBounds(const BlockBounds& a, const BlockBounds& b) {
+  BlockBounds box;
+  for (int i = 0; i < 3; i++) {
+    box.lo[i] = std::min(a.lo[i], b.lo[i]);
+    box.hi[i] = std::max(a.hi[i], b.hi[i]);
+  }
+  return box;
+}
+
+// fill the mesh with the blocks of a species that the view sees, back to
+// back: fill(first, n, at) writes agents [first, first + n) of the species
+// from vertex at. returns how many agents that was
+template <typename Fill>
+unsigned visualizeBlocks(unsigned count, const BlockBounds* bounds,
+                         const ViewRegion& view, al::Mesh& mesh, Fill fill) {
+  unsigned blocks = blocksFor(count);
+  unsigned visible = 0;
+  for (unsigned b = 0; b < blocks; b++)
+    if (view.sees(bounds[b])) visible += blockLength(count, b);
+  if (mesh.vertices().size() != visible) allocateMesh(mesh, visible);
+  unsigned at = 0;
+  for (unsigned b = 0; b < blocks; b++) {
+    if (!view.sees(bounds[b])) continue;
+    fill(b * BLOCK, blockLength(count, b), at);
+    at += blockLength(count, b);
+  }
+  return visible;
+}
@@ -0,0 +1,244 @@
+// MAT201B final project
+// lockstep distribution: every node runs the simulation itself and the
+// sender only broadcasts how to advance it
+//
+// the simulation is a function of its seed, its parameters and how many
+// steps it has taken (CounterRandom streams, stages in a fixed order), so
+// per frame the sender sends a LockstepFrame: the steps to take, the
+// parameter values to take them with and, now and then, a hash of the
+// state the frame should end in. every so often it also takes a snapshot
+// of the whole simulation and sends it in chunks over the next frames;
+// nodes that join late, miss a frame or end up with a different hash start
+// over from the next snapshot and replay the frames since.
+//
+// messages are OSC blobs on one UDP port,
+//
+//   /lockstep/frame     a LockstepFrame
+//   /lockstep/snapshot  a SnapshotChunk, header and the bytes used
+//
+// and the receiving thread hands them to the main thread through
+// SpscQueues.
+
+#pragma once
+
+#include "al/protocol/al_OSC.hpp"
+#include "species.hpp"
+#include "spsc_queue.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+struct LockstepFrame {
+  enum { SETTINGS = 16 };  // room for the parameter values
+  enum { SNAPSHOT = 1 };   // flag: a snapshot was taken as the frame began
+
+  uint32_t sequence;  // frames sent so far, counting this one
+  uint32_t tick;      // steps taken before this frame
+  uint32_t steps;     // steps this frame takes
+  uint32_t flags;
+  float alpha;        // how far past the last step the frame is drawn
+  float settings[SETTINGS];
+  uint64_t hash;      // of the state after the frame, 0 if not checked
+};
+
+struct SnapshotChunk {
+  // bytes of snapshot per message; with the OSC framing a chunk still
+  // fits one Ethernet frame, so losing a fragment never costs a chunk
+  enum { CAPACITY = 1024 };
+
+  uint32_t frame;   // sequence of the frame the snapshot was taken at
+  uint32_t index;   // which chunk this is
+  uint32_t chunks;  // of how many
+  uint32_t total;   // bytes in the whole snapshot
+  uint32_t bytes;   // used of data
+  uint8_t data[CAPACITY];
+};
+
+// gathers the chunks of one snapshot; a chunk of another starts over
+class SnapshotAssembler {
+ public:
+  void add(const SnapshotChunk& c) {
+    if (c.chunks == 0 || c.index >= c.chunks ||
+        size_t(c.index) * SnapshotChunk::CAPACITY + c.bytes > c.total)
+      return;
+    if (c.frame != frame || c.total != bytes.size()) {
+      frame = c.frame;
+      bytes.assign(c.total, 0);
+      have.assign(c.chunks, false);
+      missing = c.chunks;
+    }
+    if (have[c.index]) return;
+    std::memcpy(&bytes[size_t(c.index) * SnapshotChunk::CAPACITY], c.data,
+                c.bytes);
+    have[c.index] = true;
+    missing--;
+  }
+
+  bool complete() const { return !have.empty() && missing == 0; }
+
+  uint32_t frame{0};
+  std::vector<uint8_t> bytes;
+
+ private:
+  std::vector<bool> have;
+  unsigned missing{0};
+};
+
+// chunk `index` of bytes, as one message to address; chunk is scratch
+inline void sendChunk(al::osc::Send& sender, const char* address,
+                      uint32_t frame, const std::vector<uint8_t>& bytes,
+                      unsigned index, SnapshotChunk& chunk) {
+  size_t capacity = SnapshotChunk::CAPACITY;
+  size_t at = index * capacity;
+  chunk.frame = frame;
+  chunk.index = index;
+  chunk.chunks = unsigned((bytes.size() + capacity - 1) / capacity);
+  chunk.total = uint32_t(bytes.size());
+  chunk.bytes = uint32_t(std::min(bytes.size() - at, capacity));
+  std::memcpy(chunk.data, &bytes[at], chunk.bytes);
+  al::osc::Packet packet(sizeof(SnapshotChunk) + 64);
+  packet.beginMessage(address);
+  packet << al::osc::Blob(&chunk, offsetof(SnapshotChunk, data) + chunk.bytes);
+  packet.endMessage();
+  sender.send(packet);
+}
+
+// the chunk in a blob, into chunk; false if it is not a whole one
+inline bool readChunk(const al::osc::Blob& blob, SnapshotChunk& chunk) {
+  if (blob.size < offsetof(SnapshotChunk, data) ||
+      blob.size > sizeof(SnapshotChunk))
+    return false;
+  std::memcpy(&chunk, blob.data, blob.size);
+  return offsetof(SnapshotChunk, data) + chunk.bytes == blob.size;
+}
+
+// one end of the lockstep broadcast: a sender or a listener
+class LockstepLink : public al::osc::PacketHandler {
+ public:
+  // sender: frames and snapshots go to address (a broadcast address for
+  // a whole cluster) on port
+  bool send(const char* address, uint16_t port) {
+    return sender.open(port, address);
+  }
+
+  // receiver: start the thread that takes messages on port
+  bool listen(uint16_t port) {
+    if (!receiver.open(port)) return false;
+    receiver.handler(*this);
+    return receiver.start();
+  }
+
+  void sendFrame(const LockstepFrame& f) {
+    al::osc::Packet packet(sizeof(LockstepFrame) + 64);
+    packet.beginMessage("/lockstep/frame");
+    packet << al::osc::Blob(&f, sizeof(f));
+    packet.endMessage();
+    sender.send(packet);
+    framesSent++;
+  }
+
+  // replace whatever snapshot is still going out; sendChunks sends it a
+  // few chunks per frame so it does not flood the network in one go
+  void beginSnapshot(uint32_t frame, const std::vector<uint8_t>& bytes) {
+    pending = bytes;
+    pendingFrame = frame;
+    nextChunk = 0;
+  }
+
+  void sendChunks(unsigned most) {
+    size_t capacity = SnapshotChunk::CAPACITY;
+    unsigned chunks = unsigned((pending.size() + capacity - 1) / capacity);
+    for (unsigned n = 0; n < most && nextChunk < chunks; n++, nextChunk++) {
+      sendChunk(sender, "/lockstep/snapshot", pendingFrame, pending,
+                nextChunk, chunk);
+      chunksSent++;
+    }
+  }
+
+  // receiving thread
+  void onMessage(al::osc::Message& m) override {
+    al::osc::Blob blob;
+    if (m.typeTags() != "b") return;
+    m >> blob;
+    if (m.addressPattern() == "/lockstep/frame" &&
+        blob.size == sizeof(LockstepFrame)) {
+      LockstepFrame f;
+      std::memcpy(&f, blob.data, sizeof(f));
+      frames.push(f);
+    } else if (m.addressPattern() == "/lockstep/snapshot" &&
+               readChunk(blob, received)) {
+      chunks.push(received);
+    }
+  }
+
+  // filled by the receiving thread, drained by the main thread
+  SpscQueue<LockstepFrame, 256> frames;
+  SpscQueue<SnapshotChunk, 256> chunks;
+
+  unsigned long framesSent{0}, chunksSent{0};
+
+ private:
+  al::osc::Send sender;
+  al::osc::Recv receiver;
+  std::vector<uint8_t> pending;  // the snapshot going out
+  uint32_t pendingFrame{0};
+  unsigned nextChunk{0};
+  SnapshotChunk chunk;     // main thread, the one being sent
+  SnapshotChunk received;  // receiving thread
+};
+
+// snapshots are the raw arrays back to back, so a restored node has the
+// sender's exact bits
+template <typename T>
+void writeArray(std::vector<uint8_t>& out, const T* data, size_t count) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+  out.insert(out.end(), bytes, bytes + count * sizeof(T));
+}
+
+template <typename T>
+bool readArray(const std::vector<uint8_t>& in, size_t& at, T* data,
+               size_t count) {
+  size_t length = count * sizeof(T);
+  if (at + length > in.size()) return false;
+  std::memcpy(data, in.data() + at, length);
+  at += length;
+  return true;
+}
+
+// the arrays that carry over from one step to the next; the rest (flock,
+// acceleration) are rebuilt at the start of every step
+template <typename T>
+void saveSpecies(const Species<T>& s, std::vector<uint8_t>& out) {
+  for (auto* a : {&s.px, &s.py, &s.pz, &s.ox, &s.oy, &s.oz, &s.qw, &s.qx,
+                  &s.qy, &s.qz, &s.vx, &s.vy, &s.vz})
+    writeArray(out, a->data(), s.n);
+}
+
+template <typename T>
+bool loadSpecies(Species<T>& s, unsigned count, const std::vector<uint8_t>& in,
+                 size_t& at) {
+  s.resize(count);
+  for (auto* a : {&s.px, &s.py, &s.pz, &s.ox, &s.oy, &s.oz, &s.qw, &s.qx,
+                  &s.qy, &s.qz, &s.vx, &s.vy, &s.vz})
+    if (!readArray(in, at, a->data(), count)) return false;
+  return true;
+}
+
+// FNV-1a over the bit patterns of positions, orientations and velocities,
+// a word at a time; two nodes in step agree on it exactly
+template <typename T>
+uint64_t hashSpecies(const Species<T>& s,
+                     uint64_t h = 14695981039346656037ull) {
+  static_assert(sizeof(T) == sizeof(uint32_t), "hashes 32-bit words");
+  for (auto* a : {&s.px, &s.py, &s.pz, &s.qw, &s.qx, &s.qy, &s.qz, &s.vx,
+                  &s.vy, &s.vz})
+    for (unsigned i = 0; i < s.n; i++) {
+      uint32_t word;
+      std::memcpy(&word, &(*a)[i], sizeof(word));
+      h = (h ^ word) * 1099511628211ull;
+    }
+  return h;
+}
@@ -1,120 +1,269 @@
 #include "al/app/al_DistributedApp.hpp"
 #include "al/app/al_App.hpp"
-#include "al/math/al_Random.hpp"
-#include "al/spatial/al_HashSpace.hpp"
 #include "al/ui/al_ControlGUI.hpp" 
 #include "al/graphics/al_Font.hpp"
+#include "al/graphics/al_VAOMesh.hpp"
 #include "al/sound/al_SoundFile.hpp"
 #include "al_ext/statedistribution/al_CuttleboneStateSimulationDomain.hpp"
+#include "../counter_random.hpp"
+#include "../latency.hpp"
+#include "../profiler.hpp"
+#include "../snapshot_buffer.hpp"
+#include "../trace.hpp"
+#include "interest.hpp"
+#include "lockstep.hpp"
+#include "reckoning.hpp"
+#include "species.hpp"
+#include "scheduler.hpp"
+#include "shared_memory.hpp"
+#include "stream.hpp"
+#include "spsc_queue.hpp"
+#include "voices.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <deque>
 #include <iostream>
+#include <random>
 #include <fstream>
+#include <map>
+#include <memory>
 #include <vector>
 using namespace al;
 using namespace std;
 
-const int birdsN = 150;
-const int predatorsN = 3;
-const int insectN = 100;
-const int pestN = 20;
+string slurp(string fileName); 
+
+// every position the sender can produce (respawns land in [-1, 1])
+const WorldBounds worldBounds;
+
+// a burst of one sample the audio callback should start, stamped with when
+// the simulation asked for it. onAnimate pushes these and onSound drains
+// them once per block, so the two threads share nothing else.
+enum Sound { FLY, EAT, SOUNDS };
+struct SoundEvent {
+  double time;      // seconds on the steady clock
+  Sound sound;
+  unsigned caught;  // predation events behind it, one voice each
+};
 
-Vec3f rv(float scale = 1.0f) {
-  return Vec3f(rnd::uniformS(), rnd::uniformS(), rnd::uniformS()) * scale;
+double steadySeconds() {
+  return chrono::duration<double>(
+             chrono::steady_clock::now().time_since_epoch())
+      .count();
 }
 
-string slurp(string fileName); 
+// the font atlas is rasterized once and every distinct string is laid out
+// once, so a repeated HUD message costs a map lookup
+struct GlyphCache {
+  Font font;
+  map<pair<string, float>, VAOMesh> meshes;
 
-HashSpace birdsSpace(6, birdsN);
-HashSpace predatorsSpace(1, predatorsN);
-HashSpace insectSpace(3, insectN);
-HashSpace pestSpace(1, pestN);
+  bool load(const char* fileName, int fontSize, int bitmapSize) {
+    meshes.clear();
+    return font.load(fileName, fontSize, bitmapSize);
+  }
 
-struct SoundPlayer : SoundFile {
-  int index{0};
-  float operator()() {
-    float value = data[index];
-    index++;
-    if (index < 1){
-      return 0;
-    }
-    if (index > data.size())
-      index = 0;
-    return value;
+  VAOMesh& mesh(const string& message, float height) {
+    auto key = make_pair(message, height);
+    auto found = meshes.find(key);
+    if (found != meshes.end()) return found->second;
+    // counters in the HUD make new strings, keep the cache bounded
+    if (meshes.size() >= 256) meshes.clear();
+    VAOMesh& m = meshes[key];
+    font.write(m, message.c_str(), height);
+    m.update();
+    return m;
   }
 };
 
-struct Birds : Pose {
-  Vec3f heading;
-  Vec3f center; 
-  Vec3f velocity;
-  Vec3f acceleration;
-  unsigned flockCount{1};
+// scheduler resources: one group of bits per species, then shared things
+enum SpeciesId { BIRDS, PREDATORS, INSECT, PEST, SPECIES };
+enum SpeciesArray {
+  POSITION = 1,
+  ORIENTATION = 2,
+  VELOCITY = 4,
+  ACCELERATION = 8,
+  FLOCK = 16,     // heading, center and flockCount
+  INDEX = 32,     // the species' SpatialGrid
+  SHARED = 64,    // the species' slice of SharedState
+  PREVIOUS = 128, // position at the previous step
+  NEIGHBOURS = 256, // the species' neighbour lists
+  BOUNDS = 512,   // the boxes around the species' blocks in SharedState
+  RECKON = 1024,  // the species' slice of the outgoing MovingPoses
+  ARRAYS = 12
 };
+const Resources EVENTS = Resources(1) << (SPECIES * ARRAYS);
+const Resources UPDATES = EVENTS << 1;  // the update list and Reckoning
 
-struct Predators : Pose {
-  Vec3f heading;
-  Vec3f center; 
-  Vec3f velocity;
-  Vec3f acceleration;
-  unsigned flockCount{1};
-};
+Resources arrays(int species, unsigned mask) {
+  return Resources(mask) << (species * ARRAYS);
+}
 
-struct Insect : Pose {
-  Vec3f heading;
-  Vec3f center; 
-  Vec3f velocity;
-  Vec3f acceleration;
-  unsigned flockCount{1};
-};
+// what a random draw is for; with the species, agent and step it names a
+// CounterRandom stream, so no two draws share one
+enum Purpose { PLACE, AIM, EATEN, INFECTED, PURPOSES };
 
-struct Pest : Pose {
-  Vec3f heading;
-  Vec3f center; 
-  Vec3f velocity;
-  Vec3f acceleration;
-  unsigned flockCount{1};
-};
+// who hunts whom in the interaction passes
+enum Interaction { PREDATORS_BIRDS, BIRDS_INSECT, PEST_BIRDS, INTERACTIONS };
 
-struct BirdsAttribute{
-  Vec3f position;
-  Vec3f forward;
-  Vec3f up;
-};
+// the sound each kind of catch makes
+const Sound interactionSound[INTERACTIONS] = {EAT, EAT, FLY};
 
-struct PredatorsAttribute{
-  Vec3f position;
-  Vec3f forward;
-  Vec3f up;
-};
+// what the interaction passes did; they only bump counters, and the HUD
+// text and audio are derived from the totals once per frame
+struct EventCounts {
+  unsigned searched[INTERACTIONS];  // hunters that looked for prey
+  unsigned caught[INTERACTIONS];    // prey eaten (or birds infected)
 
-struct InsectAttribute{
-  Vec3f position;
-  Vec3f forward;
-  Vec3f up;
+  EventCounts() { clear(); }
+  void clear() {
+    for (int i = 0; i < INTERACTIONS; i++) searched[i] = caught[i] = 0;
+  }
+  unsigned totalCaught() const {
+    unsigned total = 0;
+    for (int i = 0; i < INTERACTIONS; i++) total += caught[i];
+    return total;
+  }
+  EventCounts& operator+=(const EventCounts& other) {
+    for (int i = 0; i < INTERACTIONS; i++) {
+      searched[i] += other.searched[i];
+      caught[i] += other.caught[i];
+    }
+    return *this;
+  }
 };
 
-struct PestAttribute{
-  Vec3f position;
-  Vec3f forward;
-  Vec3f up;
+// how many of each species to simulate, chosen at startup with
+// --birds N --predators N --insect N --pest N
+struct Populations {
+  unsigned count[SPECIES] = {150, 3, 100, 20};
+
+  unsigned total() const {
+    unsigned sum = 0;
+    for (int s = 0; s < SPECIES; s++) sum += count[s];
+    return sum;
+  }
+
+  void parse(int argc, char* argv[]) {
+    const char* flags[SPECIES] = {"--birds", "--predators", "--insect",
+                                  "--pest"};
+    for (int i = 1; i + 1 < argc; i++)
+      for (int s = 0; s < SPECIES; s++)
+        if (string(argv[i]) == flags[s]) count[s] = unsigned(atoi(argv[++i]));
+  }
+
+  // anything that is not a population flag or its value, in order
+  static vector<char*> positional(int argc, char* argv[]) {
+    vector<char*> args;
+    for (int i = 1; i < argc; i++) {
+      string arg(argv[i]);
+      if (arg.compare(0, 2, "--") == 0 && arg != "--bench")
+        i++;
+      else
+        args.push_back(argv[i]);
+    }
+    return args;
+  }
 };
 
-struct SharedState{
-  BirdsAttribute birds[birdsN];
-  PredatorsAttribute predators[predatorsN];
-  InsectAttribute insect[insectN];
-  PestAttribute pest[pestN];
+// Cuttlebone needs a fixed-size state and sends all of it every frame, so
+// SharedState only has room for MAX_AGENTS agents in total, chosen when
+// building. the default is what Cuttlebone carries comfortably (about
+// 130 KB a frame), far past the default populations; the show build,
+//
+//   -DMAX_AGENTS=131072
+//
+// holds 100k+ agents and runs with --stream or --shm, which carry only
+// the first header.bytes. below either cap populations are set at startup
+#define CUTTLEBONE_AGENTS 8192
+#ifndef MAX_AGENTS
+#define MAX_AGENTS CUTTLEBONE_AGENTS
+#endif
+const unsigned maxAgents = MAX_AGENTS;
+// every species may end in a short block
+const unsigned maxBlocks = maxAgents / BLOCK + SPECIES;
+// a state is only sent as updates while they are smaller than every pose
+const unsigned maxUpdates =
+    maxAgents * sizeof(MovingPose) / sizeof(AgentUpdate);
+
+struct StateHeader {
+  StateStamp stamp;         // which state this is and when it was sent
+  uint32_t bytes;           // header, bounds and the poses in use
+  uint32_t epoch;           // bumped whenever the sender renumbers agents
+  uint32_t updates;         // AgentUpdates in the state, or FULL_STATE
+  double time;              // simulated seconds the poses are for
+  uint32_t count[SPECIES];  // agents in each species' block
   float birdsSize;
   float predatorsSize;
   float insectSize;
   float ratio;
   float background;
+  float drawDelay;          // renderers draw this far behind the newest state
 };
 
-class MyApp : public DistributedAppWithState<SharedState> {
-  bool freeze = false;
-  Font text;
-  SoundPlayer fly;
-  SoundPlayer eat;
+enum : uint32_t { FULL_STATE = 0xffffffffu };
+
+// the header, the box around every BLOCK of poses (interest.hpp), then
+// either every agent's pose and velocity, one block per species back to
+// back, or only the agents receivers need again (reckoning.hpp)
+struct SharedState{
+  StateHeader header;
+  BlockBounds bounds[maxBlocks];
+  union {
+    MovingPose agents[maxAgents];      // header.updates == FULL_STATE
+    AgentUpdate updates[maxUpdates];   // the first header.updates
+  };
+
+  void layout(const Populations& populations) {
+    for (int s = 0; s < SPECIES; s++) header.count[s] = populations.count[s];
+    header.updates = FULL_STATE;
+    header.bytes = bytesFor(FULL_STATE);
+  }
+
+  unsigned total() const { return offset(SPECIES); }
+
+  uint32_t bytesFor(uint32_t updates) const {
+    size_t poses = updates == FULL_STATE ? total() * sizeof(MovingPose)
+                                         : updates * sizeof(AgentUpdate);
+    return uint32_t(offsetof(SharedState, agents) + poses);
+  }
+
+  unsigned offset(int species) const {
+    unsigned sum = 0;
+    for (int s = 0; s < species; s++) sum += header.count[s];
+    return sum;
+  }
+
+  // the boxes of a species' blocks follow those of the species before it
+  unsigned firstBlock(int species) const {
+    unsigned sum = 0;
+    for (int s = 0; s < species; s++) sum += blocksFor(header.count[s]);
+    return sum;
+  }
+
+  BlockBounds* blockBounds(int species) {
+    return bounds + firstBlock(species);
+  }
+  const BlockBounds* blockBounds(int species) const {
+    return bounds + firstBlock(species);
+  }
+
+  // a receiver may see a state before the sender has written one
+  bool valid() const {
+    for (int s = 0; s < SPECIES; s++)
+      if (header.count[s] > maxAgents) return false;
+    return total() <= maxAgents &&
+           (header.updates == FULL_STATE || header.updates <= maxUpdates) &&
+           header.bytes == bytesFor(header.updates);
+  }
+};
+
+// the sender's simulation: species, their indices and the per-step stage
+// graph. MyApp drives it from onAnimate and the --bench mode drives it
+// without a window, audio device or Cuttlebone.
+struct Ecosystem {
   Parameter birdsMR{"/birdsMR", "", 0.4, "", 0.0, 1.5};
   Parameter predatorsMR{"/predatorsMR", "", 1.0, "", 0.0, 2.0};
   Parameter insectMR{"/insectMR", "", 0.2, "", 0.0, 1.0};
@@ -123,570 +272,1141 @@ class MyApp : public DistributedAppWithState<SharedState> {
   Parameter birdsRadius{"/birdsRadius", "", 0.05, "", 0.01, 0.9};
   Parameter insectRadius{"/insectRadius", "", 0.02, "", 0.01, 0.5};
   ParameterInt k{"/k", "", 5, "", 1, 15};
+  Parameter simRate{"/simRate", "", 60, "", 15, 240};
+  ParameterInt maxSteps{"/maxSteps", "", 4, "", 1, 16};
   Parameter birdsSize{"/birdsSize", "", 1.0, "", 0.0, 2.0};
   Parameter insectSize{"/insectSize", "", 0.3, "", 0.0, 1.0};
   Parameter predatorsSize{"/predatorsSize", "", 1.5, "", 0.5, 2.0};
   Parameter ratio{"/ratio", "", 1.0, "", 0.0, 2.0};
-  ControlGUI gui;
+  // dead reckoning: how far (world units) and how much (radians) a
+  // receiver's guess may be off before an agent is resent, and the frames
+  // in which every agent is resent regardless
+  Parameter reckonError{"/reckonError", "", 0.002, "", 0.0, 0.05};
+  Parameter reckonAngle{"/reckonAngle", "", 0.03, "", 0.0, 0.5};
+  ParameterInt refreshFrames{"/refreshFrames", "", 60, "", 1, 600};
+  // states published per second, and how far behind the newest one
+  // renderers draw (snapshot_buffer.hpp)
+  Parameter publishRate{"/publishRate", "", 60, "", 5, 120};
+  Parameter drawDelay{"/drawDelay", "", 0.05, "", 0.0, 0.1};
+
+  SpatialGrid birdsGrid;
+  SpatialGrid predatorsGrid;
+  SpatialGrid insectGrid;
+  SpatialGrid pestGrid;
+
+  Species<float> birds;
+  Species<float> predators;
+  Species<float> insect;
+  Species<float> pest;
+  Neighbours birdsNeighbours;  // k nearest flockmates, rebuilt every step
+  // steps between renumbering agents in space order, which keeps the
+  // published blocks compact as the flocks drift
+  enum { RESORT = 120 };
+  vector<unsigned> sortOrder, sortKeys;  // scratch for sortSpecies
+  // the state goes out through a transport that carries only header.bytes
+  // (--stream, --shm). only then are agents kept in compact blocks and
+  // sent as updates; Cuttlebone sends all of SharedState regardless
+  bool variableSize{false};
+  bool verbose{false};  // log index changes to the console
+
+  uint64_t seed{0};
+  uint32_t tick{0};     // steps taken, the frame in every random stream
+  EventCounts frameEvents;
+
+  ThreadPool pool;
+  StageGraph pipeline;  // one simulation step
+  StageGraph publish;   // once per rendered frame
+  FixedStep clock;
+  float stepScale{1};   // step length in 60 Hz frames
+  float alpha{1};       // how far the frame is drawn past the last step
+  double simTime{0};    // simulated seconds, at the last step
+  double sincePublish{0};  // real seconds since the last state went out
+  bool published{false};   // by the last frame
+  vector<unsigned> profileIds;  // profiler stage of each graph stage
+  SharedState* out{nullptr};
+
+  // what is published: this frame's poses, all species back to back (the
+  // block bounds are taken from them), the same with velocities, which
+  // of them receivers need, and what receivers already have
+  vector<PackedPose> poses;
+  vector<MovingPose> moving;
+  vector<uint8_t> due;
+  Reckoning reckoning;
+  uint32_t reckonedEpoch{0};
+  bool reckoned{false};    // receivers have been sent every agent
+  unsigned refreshCursor{0};  // next agent the refresh resends
+
+  // a random point for one agent; the same key always gives the same point
+  Vec3f rv(int species, unsigned id, int purpose, float scale = 1.0f) {
+    CounterRandom r(seed, id, tick, uint32_t(species * PURPOSES + purpose));
+    return Vec3f(r.uniformS(), r.uniformS(), r.uniformS()) * scale;
+  }
 
-  std::shared_ptr<CuttleboneStateSimulationDomain<SharedState>>
-      cuttleboneDomain;
+  // species s (a SpeciesId) and its index
+  Species<float>& species(int s) {
+    Species<float>* all[SPECIES] = {&birds, &predators, &insect, &pest};
+    return *all[s];
+  }
+  const Species<float>& species(int s) const {
+    return const_cast<Ecosystem*>(this)->species(s);
+  }
+  SpatialGrid& grid(int s) {
+    SpatialGrid* grids[SPECIES] = {&birdsGrid, &predatorsGrid, &insectGrid,
+                                   &pestGrid};
+    return *grids[s];
+  }
 
-  ShaderProgram birdsShader;
-  ShaderProgram predatorsShader;
-  ShaderProgram insectShader;
-  ShaderProgram pestShader;
-  Mesh birdsMesh;
-  Mesh predatorsMesh;
-  Mesh insectMesh;
-  Mesh pestMesh;
-  Mesh textMesh;
+  // as it appears in stage names ("rememberBirds") and reports
+  static const char* speciesName(int s) {
+    static const char* names[SPECIES] = {"Birds", "Predators", "Insect",
+                                         "Pest"};
+    return names[s];
+  }
 
-  vector<Birds> birds;
-  vector<Predators> predators;
-  vector<Insect> insect;
-  vector<Pest> pest;
+  void init(unsigned seed, const Populations& populations,
+            SharedState& shared){
+    const unsigned* n = populations.count;
+    this->seed = seed;
+    tick = 0;
+    out = &shared;
+    pipeline.timing = true;
+    publish.timing = true;
+    out->layout(populations);
+    resetPublish();
+    for (int s = 0; s < SPECIES; s++)
+      initSpecies(species(s), n[s], grid(s),
+                  chooseResolution(n[s], searchRadius(s)),
+                  [this, s](unsigned i, int draw) {
+                    return rv(s, i, draw == 0 ? PLACE : AIM);
+                  });
+    buildPipeline();
+  }
 
-  float t = 0;
-  int frameCount = 0;
-  bool play_fly{false};
-
-  void initBirds(){
-    for (int _ = 0; _ < birdsN; _++) {
-      Birds b;
-      b.pos(rv());
-      birdsSpace.move(_, b.pos() * birdsSpace.dim());
-      b.faceToward(rv());
-      birds.push_back(b);
-      birdsMesh.vertex(b.pos());
-      birdsMesh.normal(b.uf());
-      const Vec3f& up(b.uu());
-      birdsMesh.color(up.x, up.y, up.z);
-    }
-  }
-
-  void initPredators(){
-    for (int _ = 0; _ < predatorsN; _++) {
-      Predators p;
-      p.pos(rv());
-      predatorsSpace.move(_, p.pos() * predatorsSpace.dim());
-      p.faceToward(rv());
-      predators.push_back(p);
-      predatorsMesh.vertex(p.pos());
-      predatorsMesh.normal(p.uf());
-      const Vec3f& up(p.uu());
-      predatorsMesh.color(up.x, up.y, up.z);
-    }
-  }
-
-  void initInsect(){
-    for (int _ = 0; _ < insectN; _++) {
-      Insect i;
-      i.pos(rv());
-      insectSpace.move(_, i.pos() * insectSpace.dim());
-      i.faceToward(rv());
-      insect.push_back(i);
-      insectMesh.vertex(i.pos());
-      insectMesh.normal(i.uf());
-      const Vec3f& up(i.uu());
-      insectMesh.color(up.x, up.y, up.z);
-    }
-  }
-
-  void initPest(){
-    for (int _ = 0; _ < pestN; _++) {
-      Pest p;
-      p.pos(rv());
-      pestSpace.move(_, p.pos() * pestSpace.dim());
-      p.faceToward(rv());
-      pest.push_back(p);
-      pestMesh.vertex(p.pos());
-      pestMesh.normal(p.uf());
-      const Vec3f& up(p.uu());
-      pestMesh.color(up.x, up.y, up.z);
+  // the radius each species' index is searched with most; its grid
+  // resolution is tuned to it
+  float searchRadius(int species) {
+    switch (species) {
+      case BIRDS: return 0.5f * birdsRadius;  // queryBirds
+      case INSECT: return max(0.20f, insectRadius.get());  // dispel, eat
+      case PEST: return insectRadius;  // eatPest
+      default: return 0.25f;  // predators are never searched
     }
   }
 
-  void onCreate() override{
-    cuttleboneDomain =
-        CuttleboneStateSimulationDomain<SharedState>::enableCuttlebone(this);
-    if (!cuttleboneDomain) {
-      std::cerr << "ERROR: Could not start Cuttlebone. Quitting." << std::endl;
-      quit();
-    }
-
-    gui << birdsMR << birdsTR << birdsRadius << birdsSize
-    << predatorsMR << predatorsSize
-    << insectMR << insectTR << insectRadius << insectSize
-    << k << ratio;
-    gui.init();
-    navControl().useMouse(false);
-
-    birdsShader.compile(slurp("../birds-vertex.glsl"),
-                   slurp("../birds-fragment.glsl"),
-                   slurp("../birds-geometry.glsl"));
-    predatorsShader.compile(slurp("../predators-vertex.glsl"),
-                       slurp("../predators-fragment.glsl"),
-                       slurp("../predators-geometry.glsl"));
-    insectShader.compile(slurp("../insect-vertex.glsl"),
-                       slurp("../insect-fragment.glsl"),
-                       slurp("../insect-geometry.glsl"));
-    pestShader.compile(slurp("../pest-vertex.glsl"),
-                       slurp("../pest-fragment.glsl"),
-                       slurp("../pest-geometry.glsl"));
-
-    birdsMesh.primitive(Mesh::POINTS);
-    predatorsMesh.primitive(Mesh::POINTS);
-    insectMesh.primitive(Mesh::POINTS);
-    pestMesh.primitive(Mesh::POINTS);
-    
-    initBirds();
-    initPredators();
-    initInsect();
-    initPest();
+  // re-pick each grid's resolution when the radius it is searched with (a
+  // live parameter) has moved far enough to change it; every agent is
+  // carried over into the new grid. the index panel shows the result, and
+  // only a verbose run (the bench) logs each change
+  void tuneIndex() {
+    for (int s = 0; s < SPECIES; s++) {
+      unsigned res = chooseResolution(species(s).n, searchRadius(s));
+      if (res == grid(s).resolution()) continue;
+      if (verbose)
+        printf("%s index: %u -> %u cells per axis (%.1f candidates/query)\n",
+               speciesName(s), grid(s).resolution(), res,
+               grid(s).candidatesPerQuery());
+      regridSpecies(species(s), grid(s), res);
+    }
+  }
 
-    fly.open("../fly.wav");
-    eat.open("../eat.wav");
+  void drawIndexPanel() {
+    if (!ImGui::CollapsingHeader("index")) return;
+    for (int s = 0; s < SPECIES; s++)
+      ImGui::Text("%-9s %3u cells per axis, %.1f candidates/query",
+                  speciesName(s), grid(s).resolution(),
+                  grid(s).candidatesPerQuery());
+  }
 
-    nav().pos(0.5, 0.5, 10);
+  // nothing has been sent yet, so the next state is a full one
+  void resetPublish() {
+    unsigned total = out->total();
+    poses.assign(total, PackedPose());
+    moving.assign(total, MovingPose());
+    due.assign(total, 0);
+    reckoning.resize(total);
+    reckoned = false;
+    refreshCursor = 0;
   }
 
-  void onSound(AudioIOData& io) override {
-    while (io()) {
-      float f = play_fly ? fly() : eat();
-      io.out(0) = f;
-      io.out(1) = f;
+  // renumber every species along the Morton curve and rebuild what holds
+  // agent ids; neighbour lists are rebuilt by the next step anyway
+  void renumber() {
+    for (int s = 0; s < SPECIES; s++) {
+      sortSpecies(species(s), sortOrder, sortKeys);
+      regridSpecies(species(s), grid(s), grid(s).resolution());
     }
+    out->header.epoch++;
   }
 
-  void setBirds(){
-    for (unsigned i = 0; i < birdsN; i++) {
-      birds[i].center = birds[i].pos();
-      birds[i].heading = birds[i].uf();
-      birds[i].flockCount = 1;
-      birds[i].acceleration.zero();
+  // the sender's frame as a task graph; stages that touch disjoint arrays
+  // (e.g. the four species' accelerate/integrate) run side by side
+  void buildPipeline(){
+    Parameter* moveRates[SPECIES] = {&birdsMR, &predatorsMR, &insectMR,
+                                     &insectMR};
+    pipeline.clear();
+    publish.clear();
+
+    for (int s = 0; s < SPECIES; s++) {
+      Species<float>* sp = &species(s);
+      pipeline.add(string("remember") + speciesName(s), arrays(s, POSITION),
+                   arrays(s, PREVIOUS),
+                   [sp](unsigned b, unsigned e) { rememberSpecies(*sp, b, e); },
+                   sp->n);
+    }
+    for (int s = 0; s < SPECIES; s++) {
+      Species<float>* sp = &species(s);
+      pipeline.add(string("set") + speciesName(s),
+                   arrays(s, POSITION | ORIENTATION),
+                   arrays(s, FLOCK | ACCELERATION),
+                   [sp](unsigned b, unsigned e) { setSpecies(*sp, b, e); },
+                   sp->n);
     }
-  }
 
-  void setPredators(){
-    for (unsigned i = 0; i < predatorsN; i++) {
-      predators[i].center = predators[i].pos();
-      predators[i].heading = predators[i].uf();
-      predators[i].flockCount = 1;
-      predators[i].acceleration.zero();
+    pipeline.add("queryBirds", arrays(BIRDS, POSITION | INDEX),
+                 arrays(BIRDS, NEIGHBOURS), [this](unsigned b, unsigned e) {
+                   // birdsRadius is a fraction of half the cube, as it
+                   // was with HashSpace::maxRadius
+                   searchNeighbours(birds, birdsGrid, 0.5f * birdsRadius,
+                                    birdsNeighbours, b, e);
+                 }, birds.n, 64);
+    pipeline.add("compactBirds", 0, arrays(BIRDS, NEIGHBOURS),
+                 [this](unsigned, unsigned) {
+                   compactNeighbours(birdsNeighbours);
+                 });
+    pipeline.add("flockBirds",
+                 arrays(BIRDS, POSITION | ORIENTATION | NEIGHBOURS),
+                 arrays(BIRDS, FLOCK), [this](unsigned b, unsigned e) {
+                   flockSpecies(birds, birdsNeighbours, b, e);
+                 }, birds.n);
+    pipeline.add("alignBirds", arrays(BIRDS, POSITION),
+                 arrays(BIRDS, FLOCK | ORIENTATION),
+                 [this](unsigned b, unsigned e) {
+                   alignSpecies(birds, birdsTR.get() * stepScale, b, e);
+                 }, birds.n, 64);
+
+    for (int s = 0; s < SPECIES; s++) {
+      Species<float>* sp = &species(s);
+      Parameter* rate = moveRates[s];
+      pipeline.add(string("accelerate") + speciesName(s),
+                   arrays(s, ORIENTATION | VELOCITY), arrays(s, ACCELERATION),
+                   [sp, rate](unsigned b, unsigned e) {
+                     accelerateSpecies(*sp, rate->get(), b, e);
+                   }, sp->n);
+    }
+    for (int s = 0; s < SPECIES; s++) {
+      Species<float>* sp = &species(s);
+      pipeline.add(string("integrate") + speciesName(s),
+                   arrays(s, ACCELERATION), arrays(s, VELOCITY | POSITION),
+                   [this, sp](unsigned b, unsigned e) {
+                     integrateSpecies(*sp, stepScale, b, e);
+                   }, sp->n);
+    }
+    for (int s = 0; s < SPECIES; s++) {
+      Species<float>* sp = &species(s);
+      SpatialGrid* index = &grid(s);
+      pipeline.add(string("wrap") + speciesName(s), 0, arrays(s, POSITION),
+                   [sp](unsigned b, unsigned e) { wrapSpecies(*sp, b, e); },
+                   sp->n);
+      pipeline.add(string("makespace") + speciesName(s), arrays(s, POSITION),
+                   arrays(s, INDEX), [sp, index](unsigned, unsigned) {
+                     reindexSpecies(*sp, *index);
+                   });
     }
-  }
 
-  void setInsect(){
-    for (unsigned i = 0; i < insectN; i++) {
-      insect[i].center = insect[i].pos();
-      insect[i].heading = insect[i].uf();
-      insect[i].flockCount = 1;
-      insect[i].acceleration.zero();
+    pipeline.add("preDispelBirds",
+                 arrays(PREDATORS, POSITION | FLOCK) |
+                     arrays(BIRDS, POSITION | INDEX),
+                 arrays(BIRDS, ORIENTATION),
+                 [this](unsigned, unsigned) { preDispelBirds(); });
+    pipeline.add("pestDispelBirds",
+                 arrays(PEST, POSITION | FLOCK) |
+                     arrays(BIRDS, POSITION | INDEX),
+                 arrays(BIRDS, ORIENTATION),
+                 [this](unsigned, unsigned) { pestDispelBirds(); });
+    pipeline.add("dispelInsect",
+                 arrays(BIRDS, POSITION | FLOCK) |
+                     arrays(INSECT, POSITION | INDEX),
+                 arrays(INSECT, ORIENTATION),
+                 [this](unsigned, unsigned) { dispelInsect(); });
+    pipeline.add("eatBirds",
+                 arrays(PREDATORS, POSITION) | arrays(BIRDS, INDEX),
+                 arrays(BIRDS, POSITION | PREVIOUS) | EVENTS,
+                 [this](unsigned, unsigned) { eatBirds(); });
+    pipeline.add("eatInsect",
+                 arrays(BIRDS, POSITION) | arrays(INSECT, INDEX),
+                 arrays(INSECT, POSITION | PREVIOUS) | EVENTS,
+                 [this](unsigned, unsigned) { eatInsect(); });
+    pipeline.add("eatPest", arrays(PEST, POSITION | INDEX),
+                 arrays(BIRDS, POSITION | PREVIOUS) | EVENTS,
+                 [this](unsigned, unsigned) { eatPest(); });
+
+    for (int s = 0; s < SPECIES; s++) {
+      Species<float>* sp = &species(s);
+      PackedPose* block = poses.data() + out->offset(s);
+      publish.add(string(speciesName(s)) + "Distribute",
+                  arrays(s, POSITION | ORIENTATION | PREVIOUS),
+                  arrays(s, SHARED), [this, sp, block](unsigned b, unsigned e) {
+                    distributeSpecies(*sp, block, worldBounds, alpha, b, e);
+                  }, sp->n);
+      BlockBounds* bounds = out->blockBounds(s);
+      unsigned count = sp->n;
+      publish.add(string(speciesName(s)) + "Bounds", arrays(s, SHARED),
+                  arrays(s, BOUNDS),
+                  [this, block, bounds, count](unsigned b, unsigned e) {
+                    // unsorted agents (Cuttlebone) span the cube anyway
+                    if (!variableSize) {
+                      fill(bounds + b, bounds + min(e, blocksFor(count)),
+                           wholeWorld);
+                      return;
+                    }
+                    // receivers may draw an agent reckonError off
+                    float units = reckonError.get() /
+                                  (worldBounds.hi - worldBounds.lo) * 65535;
+                    uint16_t margin = uint16_t(ceil(units));
+                    boundBlocks(block, count, bounds, margin, b, e);
+                  }, blocksFor(count), 4);
+      publish.add(string(speciesName(s)) + "Reckon",
+                  arrays(s, SHARED | VELOCITY) | UPDATES, arrays(s, RECKON),
+                  [this, s](unsigned b, unsigned e) { reckon(s, b, e); },
+                  sp->n);
     }
+    Resources slices = 0;
+    for (int s = 0; s < SPECIES; s++) slices |= arrays(s, RECKON);
+    publish.add("packUpdates", slices, UPDATES,
+                [this](unsigned, unsigned) { packUpdates(); });
   }
 
-  void setPest(){
-    for (unsigned i = 0; i < pestN; i++) {
-      pest[i].center = pest[i].pos();
-      pest[i].heading = pest[i].uf();
-      pest[i].flockCount = 1;
-      pest[i].acceleration.zero();
-    }
+  // the refresh resends this many agents a frame, from refreshCursor on
+  unsigned refreshShare() const {
+    unsigned frames = unsigned(max(1, refreshFrames.get()));
+    return (unsigned(poses.size()) + frames - 1) / frames;
   }
 
-  float queryBirds(float sum){
-    for (int i = 0; i < birdsN; i++) {
-      HashSpace::Query query(k);
-      int results = query(birdsSpace, birds[i].pos() * birdsSpace.dim(),
-                          birdsSpace.maxRadius() * birdsRadius);
-      for (int j = 0; j < results; j++) {
-        int id = query[j]->id;
-        birds[i].heading += birds[id].uf();
-        birds[i].center += birds[id].pos();
-        birds[i].flockCount++;
-      }
-      sum += birds[i].flockCount;
+  // the MovingPoses of agents [b, e) of a species, and whether receivers
+  // need them: their guess drifted, or it is their turn in the refresh
+  void reckon(int species, unsigned b, unsigned e) {
+    const Species<float>& sp = this->species(species);
+    unsigned first = out->offset(species);
+    unsigned total = unsigned(poses.size());
+    unsigned share = refreshShare();
+    float error = reckonError.get();
+    float cosHalfAngle = cos(0.5f * reckonAngle.get());
+    double time = publishTime();
+    for (unsigned i = b; i < e; i++) {
+      unsigned slot = first + i;
+      // velocity is per 60 Hz frame
+      moving[slot] = packMoving(poses[slot], sp.velocity(i) * 60.0f);
+      if (!variableSize) continue;  // every agent goes out anyway
+      bool refresh = (slot + total - refreshCursor) % total < share;
+      due[slot] = refresh || reckoning.drifted(slot, moving[slot], time,
+                                               worldBounds, error,
+                                               cosHalfAngle);
     }
-    return sum;
   }
 
-  void alignBirds(){
-    for (unsigned i = 0; i < birdsN; i++) {
-      if (birds[i].flockCount < 1) {
-        printf("ERROR");
-        fflush(stdout);
-        exit(1);
+  // this state's update list from the due agents; or every agent, when
+  // that is smaller, receivers may not have them (the first state, or the
+  // agents were renumbered) or the transport sends all of the state anyway
+  void packUpdates() {
+    StateHeader& h = out->header;
+    unsigned total = unsigned(poses.size());
+    double time = publishTime();
+    unsigned count = 0;
+    for (unsigned slot = 0; slot < total; slot++) count += due[slot];
+    bool full = !variableSize || !reckoned || h.epoch != reckonedEpoch ||
+                count * sizeof(AgentUpdate) >= total * sizeof(MovingPose);
+    if (full) {
+      for (unsigned slot = 0; slot < total; slot++) {
+        out->agents[slot] = moving[slot];
+        reckoning.set(slot, moving[slot], time, worldBounds);
       }
-
-      if (birds[i].flockCount == 1) {
-        birds[i].faceToward(Vec3f(0, 0, 0), 0.003 * birdsTR);
-        continue;
+      h.updates = FULL_STATE;
+    } else {
+      unsigned n = 0;
+      for (unsigned slot = 0; slot < total; slot++) {
+        if (!due[slot]) continue;
+        out->updates[n++] = AgentUpdate{slot, moving[slot]};
+        reckoning.set(slot, moving[slot], time, worldBounds);
       }
+      h.updates = n;
+    }
+    h.time = time;
+    h.bytes = out->bytesFor(h.updates);
+    reckoned = true;
+    reckonedEpoch = h.epoch;
+    if (total > 0) refreshCursor = (refreshCursor + refreshShare()) % total;
+  }
 
-      birds[i].center /= birds[i].flockCount;
-      birds[i].heading /= birds[i].flockCount;
-
-      float distance = (birds[i].pos() - birds[i].center).mag();
+  // the simulated time the published poses are for
+  double publishTime() const { return simTime - (1 - alpha) * clock.step; }
 
-      birds[i].faceToward(birds[i].pos() + birds[i].heading, 0.003 * birdsTR);
-      birds[i].faceToward(birds[i].center, 0.003 * birdsTR);
-      birds[i].faceToward(birds[i].pos() - birds[i].center, 0.003 * birdsTR);
+  // the dispels once scaled headings by `(0.5, 0.5, 0)`, a comma
+  // expression worth its last operand; the piece was tuned with those
+  // scalars (0 for predators and birds, 0.5 for pest), so they are kept
+  void preDispelBirds(){
+    for(unsigned i = 0; i < predators.n; i++){
+      Vec3f away = predators.heading(i) * 0.0f;
+      forEachNear(birds, birdsGrid, predators.pos(i), 0.25f, [&](unsigned j){
+        birds.faceToward(j, birds.pos(j) - away, 1.0 * birdsTR);
+      });
     }
   }
 
-  void accelerateBirds(){
-    for (int i = 0; i < birdsN; i++) {
-      birds[i].acceleration += birds[i].uf() * birdsMR * 0.002;
-      birds[i].acceleration += -birds[i].velocity * 0.1; 
+  void dispelInsect(){
+    for(unsigned i = 0; i < birds.n; i++){
+      Vec3f away = birds.heading(i) * 0.0f;
+      forEachNear(insect, insectGrid, birds.pos(i), 0.20f, [&](unsigned j){
+        insect.faceToward(j, insect.pos(j) - away, 1.0 * birdsTR);
+      });
     }
   }
 
-  void acceleratePredators(){
-    for (int i = 0; i < predatorsN; i++) {
-      predators[i].acceleration += predators[i].uf() * predatorsMR * 0.002;
-      predators[i].acceleration += -predators[i].velocity * 0.1; 
+  void pestDispelBirds(){
+    for(unsigned i = 0; i < pest.n; i++){
+      Vec3f away = pest.heading(i) * 0.5f;
+      forEachNear(birds, birdsGrid, pest.pos(i), 0.15f, [&](unsigned j){
+        birds.faceToward(j, birds.pos(j) - away, 1.0 * birdsTR);
+      });
     }
   }
 
-  void accelerateInsect(){
-    for (int i = 0; i < insectN; i++) {
-      insect[i].acceleration += insect[i].uf() * insectMR * 0.002;
-      insect[i].acceleration += -insect[i].velocity * 0.1; 
+  void eatBirds(){
+    for(unsigned i = 0; i < predators.n; i++){
+      frameEvents.searched[PREDATORS_BIRDS]++;
+      forEachNear(birds, birdsGrid, predators.pos(i), birdsRadius.get(), [&](unsigned j){
+        birds.teleport(j, rv(BIRDS, j, EATEN));
+        frameEvents.caught[PREDATORS_BIRDS]++;
+      });
     }
   }
 
-  void acceleratePest(){
-    for (int i = 0; i < pestN; i++) {
-      pest[i].acceleration += pest[i].uf() * insectMR * 0.002;
-      pest[i].acceleration += -pest[i].velocity * 0.1; 
+  void eatInsect(){
+    for(unsigned i = 0; i < birds.n; i++){
+      frameEvents.searched[BIRDS_INSECT]++;
+      forEachNear(insect, insectGrid, birds.pos(i), insectRadius.get(), [&](unsigned j){
+        insect.teleport(j, rv(INSECT, j, EATEN));
+        frameEvents.caught[BIRDS_INSECT]++;
+      });
     }
   }
 
-  void integrateBirds(){
-    for (int i = 0; i < birdsN; i++) {
-      birds[i].velocity += birds[i].acceleration;
-      birds[i].pos() += birds[i].velocity;
+  // a bird is infected once however many pests are near it; it is moved
+  // away, so the rest are no longer near
+  void eatPest(){
+    for(unsigned i = 0; i < birds.n; i++){
+      frameEvents.searched[PEST_BIRDS]++;
+      bool infected = false;
+      forEachNear(pest, pestGrid, birds.pos(i), insectRadius.get(),
+                  [&](unsigned) { infected = true; });
+      if (!infected) continue;
+      birds.teleport(i, rv(BIRDS, i, INFECTED));
+      frameEvents.caught[PEST_BIRDS]++;
     }
   }
 
-  void integratePredators(){
-    for (int i = 0; i < predatorsN; i++) {
-      predators[i].velocity += predators[i].acceleration;
-      predators[i].pos() += predators[i].velocity;
-    }
+  // lockstep (lockstep.hpp): the parameters a LockstepFrame carries, in
+  // a fixed order, then k and maxSteps
+  enum { FLOATS = 13, SETTINGS = FLOATS + 2 };
+  static_assert(int(SETTINGS) <= int(LockstepFrame::SETTINGS),
+                "LockstepFrame has no room for the settings");
+
+  void settings(Parameter* p[FLOATS]) {
+    Parameter* all[FLOATS] = {&birdsMR, &predatorsMR, &insectMR, &birdsTR,
+                              &insectTR, &birdsRadius, &insectRadius,
+                              &simRate, &birdsSize, &insectSize,
+                              &predatorsSize, &ratio, &drawDelay};
+    copy(all, all + FLOATS, p);
   }
 
-  void integrateInsect(){
-    for (int i = 0; i < insectN; i++) {
-      insect[i].velocity += insect[i].acceleration;
-      insect[i].pos() += insect[i].velocity;
-    }
+  void saveSettings(float* v) {
+    Parameter* p[FLOATS];
+    settings(p);
+    for (int i = 0; i < FLOATS; i++) v[i] = p[i]->get();
+    v[FLOATS] = float(k.get());
+    v[FLOATS + 1] = float(maxSteps.get());
   }
 
-  void integratePest(){
-    for (int i = 0; i < pestN; i++) {
-      pest[i].velocity += pest[i].acceleration;
-      pest[i].pos() += pest[i].velocity;
+  // only changed values are set, so GUI callbacks fire on changes alone
+  void loadSettings(const float* v) {
+    Parameter* p[FLOATS];
+    settings(p);
+    for (int i = 0; i < FLOATS; i++)
+      if (p[i]->get() != v[i]) p[i]->set(v[i]);
+    if (k.get() != int(v[FLOATS])) k.set(int(v[FLOATS]));
+    if (maxSteps.get() != int(v[FLOATS + 1]))
+      maxSteps.set(int(v[FLOATS + 1]));
+  }
+
+  // lockstep sender: plan a frame from the real frame time and run it.
+  // with a snapshot to fill, the frame starts by taking one and
+  // renumbering, so a node restarting from it rebuilds the same index
+  LockstepFrame lead(double dt, uint32_t sequence, vector<uint8_t>* snap) {
+    LockstepFrame f;
+    memset(&f, 0, sizeof(f));
+    clock.rate(simRate);
+    clock.maxSteps = maxSteps;
+    f.sequence = sequence;
+    f.tick = tick;
+    f.steps = uint32_t(clock.advance(dt));
+    f.alpha = clock.alpha();
+    saveSettings(f.settings);
+    if (snap) {
+      f.flags |= LockstepFrame::SNAPSHOT;
+      snapshot(*snap);
+      renumber();
     }
+    advance(int(f.steps), f.alpha);
+    return f;
   }
 
-  void makespaceBirds(){
-    for (unsigned i = 0; i < birdsN; i++) {
-      Vec3d p = birds[i].pos();
+  // lockstep receiver: run a frame the way the sender did; false if this
+  // node is not at the step the frame starts from
+  bool follow(const LockstepFrame& f) {
+    if (f.tick != tick) return false;
+    loadSettings(f.settings);
+    if (f.flags & LockstepFrame::SNAPSHOT) renumber();
+    advance(int(f.steps), f.alpha);
+    return true;
+  }
 
-      if (p.x > 1) p.x -= 1;
-      if (p.y > 1) p.y -= 1;
-      if (p.z > 1) p.z -= 1;
-      if (p.x < 0) p.x += 1;
-      if (p.y < 0) p.y += 1;
-      if (p.z < 0) p.z += 1;
+  uint64_t hash() const {
+    uint64_t h = hashSpecies(species(0));
+    for (int s = 1; s < SPECIES; s++) h = hashSpecies(species(s), h);
+    return (h ^ tick) * 1099511628211ull;
+  }
 
-      birds[i].pos(p);
-      birdsSpace.move(i, birds[i].pos() * birdsSpace.dim());
-    }
+  // everything that carries over from step to step; the indices and
+  // neighbour lists are rebuilt from it
+  struct SnapshotHeader {
+    uint64_t seed;
+    uint32_t tick;
+    uint32_t count[SPECIES];
+  };
+
+  void snapshot(vector<uint8_t>& bytes) const {
+    SnapshotHeader h;
+    h.seed = seed;
+    h.tick = tick;
+    for (int s = 0; s < SPECIES; s++) h.count[s] = species(s).n;
+    bytes.clear();
+    writeArray(bytes, &h, 1);
+    for (int s = 0; s < SPECIES; s++) saveSpecies(species(s), bytes);
+  }
+
+  // start over from a snapshot instead of a seed
+  bool restore(const vector<uint8_t>& bytes, SharedState& shared) {
+    SnapshotHeader h;
+    size_t at = 0;
+    if (!readArray(bytes, at, &h, 1)) return false;
+    Populations populations;
+    for (int s = 0; s < SPECIES; s++) populations.count[s] = h.count[s];
+    if (populations.total() > maxAgents) return false;
+    for (int s = 0; s < SPECIES; s++)
+      if (!loadSpecies(species(s), h.count[s], bytes, at)) return false;
+    seed = h.seed;
+    tick = h.tick;
+    out = &shared;
+    pipeline.timing = true;
+    publish.timing = true;
+    out->layout(populations);
+    resetPublish();
+    for (int s = 0; s < SPECIES; s++)
+      regridSpecies(species(s), grid(s),
+                    chooseResolution(h.count[s], searchRadius(s)));
+    buildPipeline();
+    return true;
   }
 
-  void makespacePredators(){
-    for (unsigned i = 0; i < predatorsN; i++) {
-      Vec3d p = predators[i].pos();
+  // hand this frame's stage times (summed over steps and chunks) to the
+  // profiler and start over
+  void profile(Profiler& profiler) {
+    StageGraph* graphs[2] = {&pipeline, &publish};
+    unsigned id = 0;
+    for (StageGraph* graph : graphs) {
+      for (unsigned i = 0; i < graph->list().size(); i++, id++) {
+        if (profileIds.size() <= id)
+          profileIds.push_back(profiler.stage(graph->list()[i].name));
+        profiler.add(profileIds[id], graph->seconds(i));
+      }
+      graph->resetTimes();
+    }
+  }
 
-      if (p.x > 1) p.x -= 1;
-      if (p.y > 1) p.y -= 1;
-      if (p.z > 1) p.z -= 1;
-      if (p.x < 0) p.x += 1;
-      if (p.y < 0) p.y += 1;
-      if (p.z < 0) p.z += 1;
+  // run as many fixed steps as the frame needs and publish the result
+  void animate(double dt){
+    clock.rate(simRate);
+    clock.maxSteps = maxSteps;
+    int steps = clock.advance(dt);
+    // the first frame past each 1 / publishRate publishes
+    sincePublish += dt;
+    bool publishing = sincePublish * publishRate >= 1;
+    if (publishing) sincePublish = fmod(sincePublish, 1 / publishRate.get());
+    advance(steps, clock.alpha(), publishing);
+  }
 
-      predators[i].pos(p);
-      predatorsSpace.move(i, predators[i].pos() * predatorsSpace.dim());
+  // take `steps` fixed steps and publish alpha of the way past the last
+  void advance(int steps, float alpha, bool publishing = true) {
+    frameEvents.clear();
+    clock.rate(simRate);
+    stepScale = float(clock.step * 60);
+    tuneIndex();
+    birdsNeighbours.reserve(birds.n, unsigned(max(1, k.get())));
+    for (int s = 0; s < steps; s++) {
+      if (variableSize && tick % RESORT == 0) renumber();
+      pipeline.run(pool);
+      tick++;
+      simTime += clock.step;
     }
+    published = publishing;
+    if (!publishing) return;
+    this->alpha = alpha;
+    publish.run(pool);
+    out->header.birdsSize = birdsSize.get();
+    out->header.predatorsSize = predatorsSize.get();
+    out->header.insectSize = insectSize.get();
+    out->header.ratio = ratio.get();
+    out->header.drawDelay = drawDelay.get();
   }
+};
+
+class MyApp : public DistributedAppWithState<SharedState> {
+ public:
+  Populations populations;  // set by main before start()
+  ViewRegion view;          // what this renderer shows, from --view
+  // --lockstep ADDRESS: every node simulates and the primary broadcasts
+  // frames to ADDRESS (lockstep.hpp); empty, the state goes over Cuttlebone
+  string lockstepAddress;
+  // --stream ADDRESS: the sender broadcasts each state compressed to
+  // ADDRESS (stream.hpp) rather than over Cuttlebone
+  string streamAddress;
+  // --shm NAME: the primary also publishes into shared memory NAME
+  // (shared_memory.hpp); renderers on its machine read it from there
+  string shmName;
+
+ private:
+  bool freeze = false;
+  GlyphCache text;
+  Sample samples[SOUNDS];  // fly.wav, eat.wav
+  // one-shots per catch: a short buzz cut from fly.wav (the whole file is
+  // 7 s, and infections would pile it up) and eat.wav
+  Sample shots[SOUNDS];
+  Ecosystem eco;
+  ControlGUI gui;
+
+  std::shared_ptr<CuttleboneStateSimulationDomain<SharedState>>
+      cuttleboneDomain;
 
-  void makespaceInsect(){
-    for (unsigned i = 0; i < insectN; i++) {
-      Vec3d p = insect[i].pos();
+  ShaderProgram birdsShader;
+  ShaderProgram predatorsShader;
+  ShaderProgram insectShader;
+  ShaderProgram pestShader;
+  Mesh birdsMesh;
+  Mesh predatorsMesh;
+  Mesh insectMesh;
+  Mesh pestMesh;
+  string hudMessage;
 
-      if (p.x > 1) p.x -= 1;
-      if (p.y > 1) p.y -= 1;
-      if (p.z > 1) p.z -= 1;
-      if (p.x < 0) p.x += 1;
-      if (p.y < 0) p.y += 1;
-      if (p.z < 0) p.z += 1;
+  float t = 0;
+  int frameCount = 0;
+  SpscQueue<SoundEvent, 256> soundEvents;
+  VoicePool<64> voices;     // audio thread only
+  // the bed under the catches, as before the voice pool: fly.wav or
+  // eat.wav looping, swapped by every odd number of catches; audio thread
+  // only once started
+  Voice beds[SOUNDS];
+  Sound bed{EAT};
+  unsigned voiceCount{0};   // audio thread only, spreads voices across pan
+  // the mix is scaled by this and soft-clipped, so a burst of catches over
+  // the bed saturates instead of clipping
+  const float masterGain = 0.5f;
+  // what the voices panel shows, written by the audio thread
+  std::atomic<unsigned> voicesPlaying{0};
+  std::atomic<unsigned long> voicesStolen{0};
+  float mixLeft[256];
+  float mixRight[256];
+  EventCounts secondEvents;
+  EventCounts lastSecondEvents;
+
+  // where the frame goes; the simulation stages report through eco.profile
+  Profiler profiler;
+  unsigned frameStage, animateStage, streamStage, drawStage;
+  unsigned visualizeStage[SPECIES];
+
+  // who did what when, across the main, worker and audio threads; 't'
+  // writes trace.json. Cuttlebone sends happen between "animate" and
+  // "draw", outside any span
+  TraceRecorder trace;
+  bool audioThreadNamed{false};  // audio thread only
+
+  // how old the drawn state is, and how many states were missed or drawn
+  // twice
+  LatencyMonitor latency;
+
+  // what this node draws: the updates of every state it sees applied to
+  // the poses it had, carried along to the state's time
+  Reckoning reckoning;
+  // update lists number agents as in their epoch, so they are only
+  // applied on top of a full state of the same one
+  uint32_t reckoningEpoch{0};
+  bool reckoningFull{false};  // a full state has been applied
+  unsigned long foreignUpdates{0};  // update lists dropped for their epoch
+  // ...and drawn from the last few of them, blended (snapshot_buffer.hpp),
+  // each kept with its block bounds
+  SnapshotBuffer snapshots;
+  vector<BlockBounds> snapshotBounds[SnapshotBuffer::CAPACITY];
+  vector<BlockBounds> drawnBounds;  // around both states drawn between
+
+  // the node that runs the clock: the Cuttlebone sender, or the primary in
+  // lockstep mode
+  bool sender{false};
+
+  // lockstep mode. a snapshot goes out every SNAPSHOT_EVERY frames and a
+  // state hash every HASH_EVERY; a receiver that is out of step keeps up
+  // to LOG_LIMIT frames to replay from the next snapshot
+  enum { SNAPSHOT_EVERY = 600, HASH_EVERY = 30, CHUNKS_PER_FRAME = 64 };
+  enum { LOG_LIMIT = 1024 };
+  enum { LOCKSTEP_PORT = 16447 };
+  LockstepLink lockstep;
+  uint32_t lockstepFrames{0};  // sent, or on a receiver the last one run
+  vector<uint8_t> snapshotBytes;  // sender
+  deque<LockstepFrame> lockstepLog;  // receiver, frames not run yet
+  SnapshotAssembler lockstepSnapshot;
+  bool inStep{false};
+  unsigned long outOfStep{0};
+
+  // stream mode; a keyframe every KEYFRAME_EVERY states
+  enum { STREAM_PORT = 16448, KEYFRAME_EVERY = 10 };
+  StateStream<SharedState> stream;
+
+  // shm mode: written by the sender, or copied from by a renderer
+  SharedMemoryLink<SharedState> shm;
 
-      insect[i].pos(p);
-      insectSpace.move(i, insect[i].pos() * insectSpace.dim());
+  void onCreate() override{
+    // a renderer next to the sender needs no network at all
+    bool local = false;
+    if (!shmName.empty() && !lockstepping() && !isPrimary()) {
+      local = shm.open(shmName.c_str());
+      printf(local ? "reading the state from shared memory %s\n"
+                   : "no shared memory %s here, using the network\n",
+             shmName.c_str());
     }
-  }
 
-  void makespacePest(){
-    for (unsigned i = 0; i < pestN; i++) {
-      Vec3d p = pest[i].pos();
+    if (local) {
+      sender = false;
+    } else if (streaming()) {
+      sender = isPrimary();
+      stream.encoder.keyframeEvery = KEYFRAME_EVERY;
+      stream.encoder.stride = sizeof(MovingPose);
+      bool open = sender ? stream.send(streamAddress.c_str(), STREAM_PORT)
+                         : stream.listen(STREAM_PORT);
+      if (!open) {
+        std::cerr << "ERROR: Could not open the stream port. Quitting."
+                  << std::endl;
+        quit();
+      }
+    } else if (lockstepAddress.empty()) {
+      if (maxAgents > CUTTLEBONE_AGENTS)
+        std::cerr << "WARNING: Cuttlebone sends all "
+                  << sizeof(SharedState) / 1024 << " KB of this build's "
+                  << "SharedState every frame; run it with --stream or --shm."
+                  << std::endl;
+      cuttleboneDomain =
+          CuttleboneStateSimulationDomain<SharedState>::enableCuttlebone(this);
+      if (!cuttleboneDomain) {
+        std::cerr << "ERROR: Could not start Cuttlebone. Quitting."
+                  << std::endl;
+        quit();
+      }
+      sender = cuttleboneDomain && cuttleboneDomain->isSender();
+    } else {
+      sender = isPrimary();
+      bool open = sender ? lockstep.send(lockstepAddress.c_str(),
+                                         LOCKSTEP_PORT)
+                         : lockstep.listen(LOCKSTEP_PORT);
+      if (!open) {
+        std::cerr << "ERROR: Could not open the lockstep port. Quitting."
+                  << std::endl;
+        quit();
+      }
+    }
+    if (!sender && !view.all() && !streaming() && !shm.attached())
+      std::cerr << "WARNING: --view culls nothing without --stream or --shm;"
+                << " drawing every agent." << std::endl;
+    if (sender && !shmName.empty() && !lockstepping() &&
+        !shm.create(shmName.c_str()))
+      std::cerr << "WARNING: Could not create shared memory " << shmName
+                << "; renderers here will use the network." << std::endl;
+
+    gui << eco.birdsMR << eco.birdsTR << eco.birdsRadius << eco.birdsSize
+    << eco.predatorsMR << eco.predatorsSize
+    << eco.insectMR << eco.insectTR << eco.insectRadius << eco.insectSize
+    << eco.k << eco.ratio << eco.simRate << eco.maxSteps
+    << eco.reckonError << eco.reckonAngle << eco.refreshFrames
+    << eco.publishRate << eco.drawDelay;
+    // onDraw runs the ImGui frame, so the stats panels share it with the
+    // parameters
+    imguiInit();
+    gui.init(5, 5, false);
+    navControl().useMouse(false);
 
-      if (p.x > 1) p.x -= 1;
-      if (p.y > 1) p.y -= 1;
-      if (p.z > 1) p.z -= 1;
-      if (p.x < 0) p.x += 1;
-      if (p.y < 0) p.y += 1;
-      if (p.z < 0) p.z += 1;
+    trace.nameThread("main");
+    eco.pipeline.trace = &trace;
+    eco.publish.trace = &trace;
+
+    {
+      TraceScope scope(trace, "compileShaders");
+      birdsShader.compile(slurp("../birds-vertex.glsl"),
+                     slurp("../birds-fragment.glsl"),
+                     slurp("../birds-geometry.glsl"));
+      predatorsShader.compile(slurp("../predators-vertex.glsl"),
+                         slurp("../predators-fragment.glsl"),
+                         slurp("../predators-geometry.glsl"));
+      insectShader.compile(slurp("../insect-vertex.glsl"),
+                         slurp("../insect-fragment.glsl"),
+                         slurp("../insect-geometry.glsl"));
+      pestShader.compile(slurp("../pest-vertex.glsl"),
+                         slurp("../pest-fragment.glsl"),
+                         slurp("../pest-geometry.glsl"));
+    }
 
-      pest[i].pos(p);
-      pestSpace.move(i, pest[i].pos() * pestSpace.dim());
+    birdsMesh.primitive(Mesh::POINTS);
+    predatorsMesh.primitive(Mesh::POINTS);
+    insectMesh.primitive(Mesh::POINTS);
+    pestMesh.primitive(Mesh::POINTS);
+    
+    eco.variableSize = sender && (streaming() || shm.attached());
+    if (sender) eco.init(random_device()(), populations, state());
+
+    {
+      TraceScope scope(trace, "loadFont");
+      text.load("../VeraMono.ttf", 28, 1024);
+    }
+
+    frameStage = profiler.stage("frame");
+    animateStage = profiler.stage("animate");
+    streamStage = profiler.stage("stream");
+    for (int s = 0; s < SPECIES; s++)
+      visualizeStage[s] =
+          profiler.stage(string("visualize") + Ecosystem::speciesName(s));
+    drawStage = profiler.stage("draw");
+
+    {
+      TraceScope scope(trace, "loadSamples");
+      samples[FLY].load("../fly.wav");
+      samples[EAT].load("../eat.wav");
     }
+    shots[FLY] = samples[FLY].excerpt(0.4f);
+    shots[EAT] = samples[EAT];
+    for (int s = 0; s < SOUNDS; s++) {
+      beds[s].start(samples[s], 1.41421356f, 0.0f);  // 1 on each side
+      beds[s].loop = true;
+    }
+
+    nav().pos(0.5, 0.5, 10);
   }
 
-  void birdsDistribute(){
-    for (unsigned i = 0; i < birdsN; i++) { 
-        BirdsAttribute b;
-        b.position = birds[i].pos();
-        b.forward = birds[i].uf();
-        b.up = birds[i].uu();
-        state().birds[i] = b;
+  void onSound(AudioIOData& io) override {
+    if (!audioThreadNamed) {
+      trace.nameThread("audio");
+      audioThreadNamed = true;
+    }
+    TraceScope scope(trace, "audio");
+    // events that waited longer than this (say the audio device stalled)
+    // are dropped rather than started all at once
+    const double stale = 0.25;
+    const unsigned burst = 8;  // most voices one event starts
+    double now = steadySeconds();
+    SoundEvent event;
+    while (soundEvents.pop(event)) {
+      if (event.caught % 2) bed = bed == FLY ? EAT : FLY;
+      if (now - event.time > stale) continue;
+      for (unsigned v = 0; v < min(event.caught, burst); v++) {
+        // golden ratio steps spread consecutive voices across the field
+        float pan = fmod(voiceCount++ * 0.618034f, 1.0f) * 2 - 1;
+        voices.play(shots[event.sound], 0.3f, pan);
       }
-      state().birdsSize = birdsSize.get();
-      state().ratio = ratio.get();
-  }
+    }
 
-  void predatorsDistribute(){
-    for (unsigned i = 0; i < predatorsN; i++) { 
-        PredatorsAttribute p;
-        p.position = predators[i].pos();
-        p.forward = predators[i].uf();
-        p.up = predators[i].uu();
-        state().predators[i] = p;
+    unsigned frames = io.framesPerBuffer();
+    bool stereo = io.channelsOut() > 1;
+    for (unsigned done = 0; done < frames; done += 256) {
+      unsigned n = min(256u, frames - done);
+      fill(mixLeft, mixLeft + n, 0.0f);
+      fill(mixRight, mixRight + n, 0.0f);
+      beds[bed].mix(mixLeft, mixRight, n);
+      voices.mix(mixLeft, mixRight, n);
+      for (unsigned i = 0; i < n; i++) {
+        float left = mixLeft[i] * masterGain, right = mixRight[i] * masterGain;
+        if (stereo) {
+          io.out(0, done + i) = softClip(left);
+          io.out(1, done + i) = softClip(right);
+        } else {
+          io.out(0, done + i) = softClip(left + right);
+        }
       }
-      state().predatorsSize = predatorsSize.get();
-      state().ratio = ratio.get();
+    }
+    voicesPlaying.store(voices.playing(), std::memory_order_relaxed);
+    voicesStolen.store(voices.stolenCount(), std::memory_order_relaxed);
   }
 
-  void insectDistribute(){
-    for (unsigned i = 0; i < insectN; i++) { 
-        InsectAttribute ic;
-        ic.position = insect[i].pos();
-        ic.forward = insect[i].uf();
-        ic.up = insect[i].uu();
-        state().insect[i] = ic;
-      }
-      state().insectSize = insectSize.get();
-      state().ratio = ratio.get();
+  // turn this frame's counters into the HUD line and the audio cues
+  void reportEvents(){
+    secondEvents += eco.frameEvents;
+    double now = steadySeconds();
+    for (int i = 0; i < INTERACTIONS; i++) {
+      unsigned caught = eco.frameEvents.caught[i];
+      if (caught > 0)
+        soundEvents.push(SoundEvent{now, interactionSound[i], caught});
+    }
+
+    const EventCounts& e = lastSecondEvents;
+    char line[128];
+    snprintf(line, sizeof(line),
+             "%u birds eaten, %u insects eaten, %u birds infected this second",
+             e.caught[PREDATORS_BIRDS], e.caught[BIRDS_INSECT],
+             e.caught[PEST_BIRDS]);
+    hudMessage = line;
   }
 
-  void pestDistribute(){
-    for (unsigned i = 0; i < pestN; i++) { 
-        PestAttribute p;
-        p.position = pest[i].pos();
-        p.forward = pest[i].uf();
-        p.up = pest[i].uu();
-        state().pest[i] = p;
-      }
-      state().insectSize = insectSize.get();
-      state().ratio = ratio.get();
+  bool lockstepping() const { return !lockstepAddress.empty(); }
+  bool streaming() const { return !streamAddress.empty(); }
+
+  // lockstep sender: run the frame, then tell everyone how
+  void leadLockstep(double dt) {
+    lockstepFrames++;
+    bool snap = lockstepFrames % SNAPSHOT_EVERY == 1;
+    LockstepFrame f =
+        eco.lead(dt, lockstepFrames, snap ? &snapshotBytes : nullptr);
+    if (snap) lockstep.beginSnapshot(f.sequence, snapshotBytes);
+    if (f.sequence % HASH_EVERY == 0) f.hash = eco.hash();
+    lockstep.sendFrame(f);
+    lockstep.sendChunks(CHUNKS_PER_FRAME);
   }
 
-  void visualizeBirds(){
-    vector<Vec3f>& v(birdsMesh.vertices());
-    vector<Vec3f>& n(birdsMesh.normals());
-    vector<Color>& c(birdsMesh.colors());
-    for (unsigned i = 0; i < birdsN; i++) {
-      v[i] = state().birds[i].position;
-      n[i] = state().birds[i].forward;
-      const Vec3d& up(state().birds[i].up);
-      c[i].set(up.x, up.y, up.z);
+  // lockstep receiver: run the frames that arrived, or, out of step, keep
+  // them until a snapshot they follow on from is complete
+  void followLockstep() {
+    SnapshotChunk chunk;
+    while (lockstep.chunks.pop(chunk)) lockstepSnapshot.add(chunk);
+    LockstepFrame f;
+    while (lockstep.frames.pop(f)) {
+      if (inStep && f.sequence == lockstepFrames + 1) {
+        runFrame(f);
+        continue;
+      }
+      if (inStep) fallOutOfStep("missed a frame");
+      if (!lockstepLog.empty() &&
+          f.sequence != lockstepLog.back().sequence + 1)
+        lockstepLog.clear();
+      lockstepLog.push_back(f);
+      if (lockstepLog.size() > LOG_LIMIT) lockstepLog.pop_front();
     }
-  }
 
-  void visualizePredators(){
-    vector<Vec3f>& v(predatorsMesh.vertices());
-    vector<Vec3f>& n(predatorsMesh.normals());
-    vector<Color>& c(predatorsMesh.colors());
-    for (unsigned i = 0; i < predatorsN; i++) {
-      v[i] = state().predators[i].position;
-      n[i] = state().predators[i].forward;
-      const Vec3d& up(state().predators[i].up);
-      c[i].set(up.x, up.y, up.z);
+    if (inStep || !lockstepSnapshot.complete() || lockstepLog.empty())
+      return;
+    uint32_t skip = lockstepSnapshot.frame - lockstepLog.front().sequence;
+    if (skip >= lockstepLog.size()) return;
+    lockstepLog.erase(lockstepLog.begin(), lockstepLog.begin() + skip);
+    if (!eco.restore(lockstepSnapshot.bytes, state())) {
+      lockstepSnapshot = SnapshotAssembler();
+      return;
+    }
+    printf("lockstep: restarted from the snapshot of frame %u\n",
+           lockstepSnapshot.frame);
+    inStep = true;
+    lockstepFrames = lockstepSnapshot.frame - 1;
+    deque<LockstepFrame> replay;
+    replay.swap(lockstepLog);
+    for (const LockstepFrame& r : replay) {
+      if (!inStep) break;
+      runFrame(r);
     }
   }
 
-  void visualizeInsect(){
-    vector<Vec3f>& v(insectMesh.vertices());
-    vector<Vec3f>& n(insectMesh.normals());
-    vector<Color>& c(insectMesh.colors());
-    for (unsigned i = 0; i < insectN; i++) {
-      v[i] = state().insect[i].position;
-      n[i] = state().insect[i].forward;
-      const Vec3d& up(state().insect[i].up);
-      c[i].set(up.x, up.y, up.z);
+  void runFrame(const LockstepFrame& f) {
+    if (!eco.follow(f)) {
+      fallOutOfStep("frame starts at another step");
+      return;
     }
+    lockstepFrames = f.sequence;
+    if (f.hash != 0 && f.hash != eco.hash())
+      fallOutOfStep("state hash differs");
+    reportEvents();
   }
 
-  void visualizePest(){
-    vector<Vec3f>& v(pestMesh.vertices());
-    vector<Vec3f>& n(pestMesh.normals());
-    vector<Color>& c(pestMesh.colors());
-    for (unsigned i = 0; i < pestN; i++) {
-      v[i] = state().pest[i].position;
-      n[i] = state().pest[i].forward;
-      const Vec3d& up(state().pest[i].up);
-      c[i].set(up.x, up.y, up.z);
-    }
+  void fallOutOfStep(const char* why) {
+    printf("lockstep: out of step at frame %u (%s)\n", lockstepFrames, why);
+    inStep = false;
+    outOfStep++;
+    lockstepLog.clear();
   }
 
-  void preDispelBirds(){
-    for(unsigned i = 0; i < predatorsN; i++){
-      for(unsigned j = 0; j < birdsN; j++){
-        float distance = (predators[i].pos() - birds[j].pos()).mag();
-        if(distance < 0.25){
-          birds[j].faceToward(birds[j].pos() - predators[i].heading * (0.5, 0.5, 0), 1.0 * birdsTR);
-        }
-      }
-    }
+  void drawVoicesPanel() {
+    if (!ImGui::CollapsingHeader("voices")) return;
+    ImGui::Text("%u of %u playing, %lu stolen", voicesPlaying.load(),
+                voices.size(), voicesStolen.load());
   }
 
-  void dispelInsect(){
-    for(unsigned i = 0; i < birdsN; i++){
-      for(unsigned j = 0; j < insectN; j++){
-        float distance = (birds[i].pos() - insect[j].pos()).mag();
-        if(distance < 0.20){
-          insect[j].faceToward(insect[j].pos() - birds[i].heading * (0.5, 0.5, 0), 1.0 * birdsTR);
-        }
-      }
-    }
+  void drawReckoningPanel() {
+    if (!ImGui::CollapsingHeader("reckoning")) return;
+    ImGui::Text("epoch %u%s, %lu update lists of another epoch dropped",
+                reckoningEpoch, reckoningFull ? "" : " (no full state yet)",
+                foreignUpdates);
   }
 
-  void pestDispelBirds(){
-    for(unsigned i = 0; i < pestN; i++){
-      for(unsigned j = 0; j < birdsN; j++){
-        float distance = (pest[i].pos() - birds[j].pos()).mag();
-        if(distance < 0.15){
-          birds[j].faceToward(birds[j].pos() - pest[i].heading * (0.5, 0.5, 0.5), 1.0 * birdsTR);
-        }
-      }
-    }
+  void drawLockstepPanel() {
+    if (!ImGui::CollapsingHeader("lockstep")) return;
+    if (sender)
+      ImGui::Text("%u frames, %lu snapshot chunks sent", lockstepFrames,
+                  lockstep.chunksSent);
+    else
+      ImGui::Text("%s, frame %u, out of step %lu times",
+                  inStep ? "in step" : "waiting for a snapshot",
+                  lockstepFrames, outOfStep);
   }
 
-  void eatBirds(){
-    for(unsigned i = 0; i < predatorsN; i++){
-      for(unsigned j = 0; j < birdsN; j++){
-        float distance = (predators[i].pos() - birds[j].pos()).mag();
-        if(distance < birdsRadius){
-          birds[j].pos() = Vec3f(rnd::uniformS(), rnd::uniformS(), rnd::uniformS());
-          text.write(textMesh, "Predators are earing birds", 0.08f);
-          play_fly = !play_fly;
-        }
-        else{
-          text.write(textMesh, "Predators are searching birds", 0.08f);
-        }
-      }
+  // updates are applied again when a state is seen twice, which changes
+  // nothing. false if the state's updates were dropped: they are for
+  // another epoch than the last full state (one was missed after the
+  // sender renumbered), and would land on the wrong agents
+  bool receiveState(const SharedState& s) {
+    unsigned total = s.total();
+    if (reckoning.size() != total) {
+      reckoning.resize(total);
+      reckoningFull = false;
     }
+    if (s.header.updates == FULL_STATE) {
+      for (unsigned slot = 0; slot < total; slot++)
+        reckoning.set(slot, s.agents[slot], s.header.time, worldBounds);
+      reckoningEpoch = s.header.epoch;
+      reckoningFull = true;
+      return true;
+    }
+    if (!reckoningFull || s.header.epoch != reckoningEpoch) {
+      foreignUpdates++;
+      return false;
+    }
+    for (unsigned u = 0; u < s.header.updates; u++) {
+      const AgentUpdate& update = s.updates[u];
+      if (update.slot < total)
+        reckoning.set(update.slot, update.moving, s.header.time, worldBounds);
+    }
+    return true;
   }
 
-  void eatInsect(){
-    for(unsigned i = 0; i < birdsN; i++){
-      for(unsigned j = 0; j < insectN; j++){
-        float distance = (birds[i].pos() - insect[j].pos()).mag();
-        if(distance < insectRadius){
-          insect[j].pos() = Vec3f(rnd::uniformS(), rnd::uniformS(), rnd::uniformS());
-          text.write(textMesh, "Birds are earing insects", 0.08f);
-          play_fly = !play_fly;
-        }
-        else{
-          text.write(textMesh, "Birds are searching insects", 0.08f);
-        }
-      }
-    }
+  // a state that came in: reckoned, and kept for drawing if that worked
+  void acceptState(const SharedState& s) {
+    if (s.valid() && receiveState(s)) bufferState(s);
   }
 
-  void eatPest(){
-    for(unsigned i = 0; i < birdsN; i++){
-      for(unsigned j = 0; j < pestN; j++){
-        float distance = (birds[i].pos() - pest[j].pos()).mag();
-        if(distance < insectRadius){
-          birds[i].pos() = Vec3f(rnd::uniformS(), rnd::uniformS(), rnd::uniformS());
-          text.write(textMesh, "Birds are infected by pest", 0.08f);
-          play_fly = !play_fly;
-        }
-        else{
-          text.write(textMesh, "Birds are searching pest", 0.08f);
-        }
-      }
+  // keep a state not seen yet, as reckoned for its time
+  void bufferState(const SharedState& s) {
+    if (snapshots.holds(s.header.time)) return;
+    unsigned total = s.total();
+    unsigned slot = snapshots.push(s.header.time, s.header.epoch, total);
+    SnapshotBuffer::Snapshot& snap = snapshots[slot];
+    for (unsigned k = 0; k < total; k++) {
+      snap.position[k] = reckoning.predict(k, s.header.time);
+      snap.orientation[k] = reckoning.orientationOf(k);
     }
+    snapshotBounds[slot].assign(s.bounds, s.bounds + s.firstBlock(SPECIES));
+  }
+
+  // the blocks to cull by: those of the state drawn, or, blending two,
+  // the box around both
+  const vector<BlockBounds>& boundsDrawn() {
+    const vector<BlockBounds>& later = snapshotBounds[snapshots.later()];
+    if (!snapshots.blends()) return later;
+    const vector<BlockBounds>& older = snapshotBounds[snapshots.older()];
+    drawnBounds.resize(later.size());
+    for (size_t b = 0; b < later.size(); b++)
+      drawnBounds[b] = unionBounds(older[b], later[b]);
+    return drawnBounds;
   }
 
   void onAnimate(double dt) override {
-    text.load("../VeraMono.ttf", 28, 1024);
+    profiler.endFrame();  // the previous frame, draw included
+    profiler.add(frameStage, dt);
+    ProfileScope scope(profiler, animateStage);
+    TraceScope span(trace, "animate");
     t += dt;
     frameCount++;
-    float sum = 0;
 
     if(t > 1){
       t -= 1;
       frameCount = 0;
+      lastSecondEvents = secondEvents;
+      secondEvents.clear();
     }
 
     if(freeze == false){
-      if (cuttleboneDomain->isSender()) {
-      setBirds();
-      setPredators();
-      setInsect();
-      setPest();
-
-      sum = queryBirds(sum);
-      alignBirds();
-
-      accelerateBirds();
-      acceleratePredators();
-      accelerateInsect();
-      acceleratePest();
-
-      integrateBirds();
-      integratePredators();
-      integrateInsect();
-      integratePest();
-
-      makespaceBirds();
-      makespacePredators();
-      makespaceInsect();
-      makespacePest();
-
-      preDispelBirds();
-      pestDispelBirds();
-      dispelInsect();
-      eatBirds();
-      eatInsect();
-      eatPest();
-
-      birdsDistribute();
-      predatorsDistribute();
-      insectDistribute();
-      pestDistribute();
+      if (sender) {
+      if (lockstepping())
+        leadLockstep(dt);
+      else
+        eco.animate(dt);
+      eco.profile(profiler);
+      if (eco.published) {
+        latency.stamp(state().header.stamp);
+        if (streaming()) {
+          ProfileScope scope(profiler, streamStage);
+          TraceScope span(trace, "encodeState");
+          stream.sendState(&state(), state().header.bytes);
+        }
+        if (shm.attached()) shm.publish(state(), state().header.bytes);
+      }
+      reportEvents();
       } 
       
-      else { }
+      else if (lockstepping()) {
+        followLockstep();
+        eco.profile(profiler);
+      }
 
-      visualizeBirds();
-      visualizePredators();
-      visualizeInsect();
-      visualizePest();
+      else if (streaming() && !shm.attached()) {
+        ProfileScope scope(profiler, streamStage);
+        TraceScope span(trace, "decodeState");
+        stream.receiveState(&state(), sizeof(state()),
+                            [this] { acceptState(state()); });
+      }
+
+      // a stream receiver accepted each state as it was decoded, and a
+      // renderer reading shared memory each intact state published since
+      // its last frame; anyone else has one state this frame. the shared
+      // memory renderer keeps the newest header for onDraw
+      const SharedState* shown = &state();
+      bool local = !sender && shm.attached();
+      bool streamed = !sender && streaming() && !local;
+      if (local)
+        shown = shm.read([this](const SharedState& s) { acceptState(s); });
+      if (shown && !streamed && !local) acceptState(*shown);
+      if (shown && shown->valid()) {
+        const SharedState& received = *shown;
+        if (local) state().header = received.header;
+        // a renderer that joined after a renumber has nothing to draw
+        // until the next full state
+        if (snapshots.empty()) return;
+        snapshots.delay = received.header.drawDelay;
+        snapshots.advance(dt);
+        latency.receive(received.header.stamp, profiler, snapshots.behind());
+        const vector<BlockBounds>& bounds = boundsDrawn();
+        Mesh* meshes[SPECIES] = {&birdsMesh, &predatorsMesh, &insectMesh,
+                                 &pestMesh};
+        for (int s = 0; s < SPECIES; s++) {
+          unsigned count = received.header.count[s];
+          const char* spans[SPECIES] = {"visualizeBirds", "visualizePredators",
+                                        "visualizeInsect", "visualizePest"};
+          ProfileScope scope(profiler, visualizeStage[s]);
+          TraceScope span(trace, spans[s]);
+          Mesh& mesh = *meshes[s];
+          unsigned first = received.offset(s);
+          const BlockBounds* blocks = bounds.data() + received.firstBlock(s);
+          visualizeBlocks(count, blocks, view, mesh,
+                          [&](unsigned b, unsigned n, unsigned at) {
+                            snapshots.draw(first + b, n, mesh, at);
+                          });
+        }
+      }
     }
   }
   
@@ -694,47 +1414,187 @@ class MyApp : public DistributedAppWithState<SharedState> {
     if(k.key() == ' '){
       freeze = !freeze;
     }
+    if (k.key() == 'p') {
+      if (profiler.writeCSV("profile.csv"))
+        printf("wrote profile.csv\n");
+    }
+    if (k.key() == 't') {
+      if (trace.writeJSON("trace.json"))
+        printf("wrote trace.json\n");
+    }
+    return true;
   }
 
   void onDraw(Graphics& g) override {
-    g.clear(state().background, state().background, state().background);
+    ProfileScope scope(profiler, drawStage);
+    TraceScope span(trace, "draw");
+    g.clear(state().header.background, state().header.background, state().header.background);
     gl::depthTesting(true); 
     gl::blending(true);      
     gl::blendTrans();        
 
     g.shader(predatorsShader);
-    g.shader().uniform("size", state().predatorsSize * 0.03);
-    g.shader().uniform("ratio", state().ratio * 0.2);
+    g.shader().uniform("size", state().header.predatorsSize * 0.03);
+    g.shader().uniform("ratio", state().header.ratio * 0.2);
     g.draw(predatorsMesh);  // rendered with predatorsShader
 
     g.shader(birdsShader);
-    g.shader().uniform("size", state().birdsSize * 0.03);
-    g.shader().uniform("ratio", state().ratio * 0.2);
+    g.shader().uniform("size", state().header.birdsSize * 0.03);
+    g.shader().uniform("ratio", state().header.ratio * 0.2);
     g.draw(birdsMesh);  // rendered with birdsShader
 
     g.shader(insectShader);
-    g.shader().uniform("size", state().insectSize * 0.03);
-    g.shader().uniform("ratio", state().ratio * 0.2);
+    g.shader().uniform("size", state().header.insectSize * 0.03);
+    g.shader().uniform("ratio", state().header.ratio * 0.2);
     g.draw(insectMesh);  
 
     g.shader(pestShader);
-    g.shader().uniform("size", state().insectSize * 0.03);
-    g.shader().uniform("ratio", state().ratio * 0.2);
+    g.shader().uniform("size", state().header.insectSize * 0.03);
+    g.shader().uniform("ratio", state().header.ratio * 0.2);
     g.draw(pestMesh); 
     
     g.texture();
-    text.tex.bind();
-    g.draw(textMesh);
-    text.tex.unbind();
+    if (!hudMessage.empty()) {
+      text.font.tex.bind();
+      g.draw(text.mesh(hudMessage, 0.08f));
+      text.font.tex.unbind();
+    }
 
     if (isPrimary()){
+      imguiBeginFrame();
       gui.draw(g);
+      gui.begin();
+      profiler.drawPanel();
+      latency.drawPanel();
+      snapshots.drawPanel();
+      if (sender) eco.drawIndexPanel();
+      if (!sender) drawReckoningPanel();
+      drawVoicesPanel();
+      if (lockstepping()) drawLockstepPanel();
+      if (streaming()) stream.drawPanel(sender);
+      if (shm.attached()) shm.drawPanel(sender);
+      gui.end();
+      imguiEndFrame();
+      imguiDraw();
     }
   }
 };
 
-int main() {
+// headless run of the sender pipeline, for timing on machines without a
+// display:  ./project --bench [steps] [seed] [--birds N ...]
+int bench(int argc, char* argv[], const Populations& populations) {
+  vector<char*> args = Populations::positional(argc, argv);
+  int steps = args.size() > 1 ? atoi(args[1]) : 1000;
+  unsigned seed = args.size() > 2 ? unsigned(atoi(args[2])) : 1;
+  static SharedState state;
+  static Ecosystem eco;
+  eco.verbose = true;
+  eco.init(seed, populations, state);
+  eco.pipeline.timing = true;
+  eco.publish.timing = true;
+
+  EventCounts total;
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < steps; i++) {
+    eco.animate(eco.clock.step);
+    total += eco.frameEvents;
+  }
+  double seconds =
+      chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  printf("%lu steps, seed %u, %u threads: %.3f s, %.1f steps/s\n",
+         eco.clock.steps, seed, eco.pool.size(), seconds,
+         eco.clock.steps / seconds);
+  printf("\n%-24s %12s %12s\n", "stage", "total ms", "us/step");
+  for (StageGraph* graph : {&eco.pipeline, &eco.publish}) {
+    for (unsigned i = 0; i < graph->list().size(); i++) {
+      double ms = graph->seconds(i) * 1e3;
+      printf("%-24s %12.3f %12.3f\n", graph->list()[i].name.c_str(), ms,
+             ms * 1e3 / max(1ul, eco.clock.steps));
+    }
+  }
+
+  printf("\n%-10s %6s %10s %10s %24s\n", "species", "count", "speed",
+         "flock", "centroid");
+  for (int s = 0; s < SPECIES; s++) {
+    const Species<float>& sp = eco.species(s);
+    double speed = 0, flock = 0;
+    Vec3d centroid;
+    for (unsigned i = 0; i < sp.n; i++) {
+      speed += sp.velocity(i).mag();
+      flock += sp.flockCount[i];
+      centroid += Vec3d(sp.pos(i));
+    }
+    double n = max(1u, sp.n);
+    printf("%-10s %6u %10.6f %10.3f %8.3f %7.3f %7.3f\n",
+           Ecosystem::speciesName(s), sp.n,
+           speed / n, flock / n, centroid.x / n, centroid.y / n,
+           centroid.z / n);
+  }
+
+  printf("\n%-10s %6s %12s %12s %8s %10s\n", "index", "cells", "moves",
+         "relinks", "changed", "per query");
+  for (int s = 0; s < SPECIES; s++) {
+    const SpatialGrid& g = eco.grid(s);
+    printf("%-10s %6u %12lu %12lu %7.2f%% %10.1f\n", Ecosystem::speciesName(s),
+           g.resolution(), g.moves, g.relinks,
+           100.0 * g.relinks / max(1ul, g.moves), g.candidatesPerQuery());
+  }
+
+  printf("\n%u birds eaten, %u insects eaten, %u birds infected\n",
+         total.caught[PREDATORS_BIRDS], total.caught[BIRDS_INSECT],
+         total.caught[PEST_BIRDS]);
+  return 0;
+}
+
+// the command line, and how many agents this build holds
+void usage(const char* program) {
+  printf("usage: %s [--birds N] [--predators N] [--insect N] [--pest N]\n"
+         "         [--stream ADDRESS | --lockstep ADDRESS] [--shm NAME]\n"
+         "         [--view x0,y0,z0,x1,y1,z1]\n"
+         "       %s --bench [steps] [seed] [--birds N ...]\n"
+         "\n"
+         "--view only culls with --stream or --shm; over Cuttlebone and\n"
+         "lockstep the agents are not sorted into blocks in space.\n"
+         "\n"
+         "this build holds %u agents in all (-DMAX_AGENTS=%u). the show\n"
+         "build, -DMAX_AGENTS=131072, holds 100k+ and should run with\n"
+         "--stream or --shm; Cuttlebone sends the whole state every frame.\n",
+         program, program, maxAgents, maxAgents);
+}
+
+int main(int argc, char* argv[]) {
+  if (argc > 1 && (string(argv[1]) == "--help" || string(argv[1]) == "-h")) {
+    usage(argv[0]);
+    return 0;
+  }
+  Populations populations;
+  populations.parse(argc, argv);
+  if (populations.total() > maxAgents) {
+    std::cerr << "ERROR: " << populations.total() << " agents requested, "
+              << "this build holds " << maxAgents << ". Quitting."
+              << std::endl;
+    usage(argv[0]);
+    return 1;
+  }
+  if (argc > 1 && string(argv[1]) == "--bench")
+    return bench(argc, argv, populations);
   MyApp app;
+  app.populations = populations;
+  for (int i = 1; i + 1 < argc; i++) {
+    string arg(argv[i]);
+    if (arg == "--lockstep") {
+      app.lockstepAddress = argv[++i];
+    } else if (arg == "--stream") {
+      app.streamAddress = argv[++i];
+    } else if (arg == "--shm") {
+      app.shmName = argv[++i];
+    } else if (arg == "--view" && !app.view.parse(argv[++i], worldBounds)) {
+      std::cerr << "ERROR: --view wants x0,y0,z0,x1,y1,z1. Quitting."
+                << std::endl;
+      return 1;
+    }
+  }
   app.start();
 }
 
@@ -0,0 +1,103 @@
+// MAT201B final project
+// dead reckoning: receivers carry each agent along the velocity it was
+// last sent with, and the sender only resends an agent once that guess
+// has drifted too far, or its turn in the refresh comes up
+//
+// the sender keeps the same Reckoning the receivers build from the
+// updates, so it knows exactly what they draw. a receiver that missed a
+// state (or just joined) is put right by the refresh, which resends every
+// agent within a bounded number of frames.
+//
+// the updates only pay off where the state goes out as header.bytes
+// (--stream, --shm); over Cuttlebone the sender publishes every agent.
+
+#pragma once
+
+#include "al/math/al_Quat.hpp"
+#include "al/math/al_Vec.hpp"
+#include "../wire_format.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// velocities are 16-bit fixed point in world units per second
+const float maxSpeed = 4.0f;
+
+inline int16_t encodeSpeed(float v) {
+  float t = std::min(1.0f, std::max(-1.0f, v / maxSpeed));
+  return int16_t(std::lround(t * 32767.0f));
+}
+
+inline float decodeSpeed(int16_t q) { return q / 32767.0f * maxSpeed; }
+
+// a pose and where it is heading
+struct MovingPose {
+  PackedPose pose;
+  int16_t velocity[3];
+};
+
+inline MovingPose packMoving(const PackedPose& pose,
+                             const al::Vec3f& velocity) {
+  MovingPose m;
+  m.pose = pose;
+  for (int a = 0; a < 3; a++) m.velocity[a] = encodeSpeed(velocity[a]);
+  return m;
+}
+
+// one agent resent
+struct AgentUpdate {
+  uint32_t slot;  // counting through every species' block
+  MovingPose moving;
+};
+
+class Reckoning {
+ public:
+  void resize(unsigned agents) {
+    position.assign(agents, al::Vec3f(0, 0, 0));
+    velocity.assign(agents, al::Vec3f(0, 0, 0));
+    orientation.assign(agents, al::Quatf());
+    sentAt.assign(agents, 0.0);
+  }
+
+  unsigned size() const { return unsigned(position.size()); }
+
+  // what a receiver makes of a MovingPose for `time`
+  void set(unsigned slot, const MovingPose& m, double time,
+           const WorldBounds& bounds) {
+    position[slot] = unpackPosition(m.pose, bounds);
+    velocity[slot] = al::Vec3f(decodeSpeed(m.velocity[0]),
+                               decodeSpeed(m.velocity[1]),
+                               decodeSpeed(m.velocity[2]));
+    orientation[slot] = unpackOrientation(m.pose);
+    sentAt[slot] = time;
+  }
+
+  al::Vec3f predict(unsigned slot, double time) const {
+    return position[slot] + velocity[slot] * float(time - sentAt[slot]);
+  }
+
+  const al::Quatf& orientationOf(unsigned slot) const {
+    return orientation[slot];
+  }
+
+  // whether receivers, guessing slot at `time`, are more than `error`
+  // away from m or turned by more than acos(cosHalfAngle) * 2
+  bool drifted(unsigned slot, const MovingPose& m, double time,
+               const WorldBounds& bounds, float error,
+               float cosHalfAngle) const {
+    al::Vec3f off = unpackPosition(m.pose, bounds) - predict(slot, time);
+    if (off.dot(off) > error * error) return true;
+    al::Quatf q = unpackOrientation(m.pose);
+    const al::Quatf& o = orientation[slot];
+    float dot = q.w * o.w + q.x * o.x + q.y * o.y + q.z * o.z;
+    return std::abs(dot) < cosHalfAngle;
+  }
+
+ private:
+  std::vector<al::Vec3f> position;  // as last sent
+  std::vector<al::Vec3f> velocity;
+  std::vector<al::Quatf> orientation;
+  std::vector<double> sentAt;       // simulated time of the last update
+};
@@ -0,0 +1,226 @@
+// MAT201B final project
+// worker pool and a small task graph for the per-frame simulation stages
+
+#pragma once
+
+#include "../trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// one bit per array (or other shared thing) a stage may touch
+typedef uint64_t Resources;
+
+// workers start with the first task, so a node that never simulates (a
+// renderer) has none
+class ThreadPool {
+ public:
+  explicit ThreadPool(unsigned threads = std::thread::hardware_concurrency())
+      : threads(std::max(1u, threads)) {}
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quitting = true;
+    }
+    wake.notify_all();
+    for (auto& w : workers) w.join();
+  }
+
+  // the thread that runs the graph helps, so it counts as one worker
+  unsigned size() const { return threads; }
+
+  void submit(std::function<void()> task) {
+    // the first task comes from the thread that runs the graph, before
+    // there is a worker to race with
+    if (!started) start();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+    idle.notify_all();
+  }
+
+  // run queued tasks on the calling thread until `left` drops to zero
+  void helpUntil(const std::atomic<int>& left) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (left.load() > 0) {
+      if (tasks.empty()) {
+        idle.wait(lock);
+        continue;
+      }
+      std::function<void()> task = std::move(tasks.front());
+      tasks.pop_front();
+      lock.unlock();
+      task();
+      lock.lock();
+    }
+  }
+
+ private:
+  void start() {
+    started = true;
+    for (unsigned i = 1; i < threads; i++)
+      workers.emplace_back([this] { work(); });
+  }
+
+  void work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      wake.wait(lock, [this] { return quitting || !tasks.empty(); });
+      if (tasks.empty()) return;
+      std::function<void()> task = std::move(tasks.front());
+      tasks.pop_front();
+      lock.unlock();
+      task();
+      lock.lock();
+      idle.notify_all();
+    }
+  }
+
+  unsigned threads;
+  bool started{false};
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable wake;  // workers: there is a task
+  std::condition_variable idle;  // runner: a task finished or was queued
+  bool quitting{false};
+};
+
+// a stage of the frame; `run` is handed [begin, end) of its `count` items.
+// stages with count 0 run once as a single task.
+struct Stage {
+  std::string name;
+  Resources reads;
+  Resources writes;
+  unsigned count;
+  unsigned grain;
+  std::function<void(unsigned, unsigned)> run;
+  // name as interned by the graph's TraceRecorder, which outlives the
+  // stage; set the first time the graph runs with a recorder
+  const char* traceName{nullptr};
+};
+
+// stages run in the order they were added unless their resources do not
+// overlap, in which case they (and the chunks inside them) run in parallel
+class StageGraph {
+ public:
+  void add(const std::string& name, Resources reads, Resources writes,
+           std::function<void(unsigned, unsigned)> run, unsigned count = 0,
+           unsigned grain = 256) {
+    Stage stage{name, reads, writes, count, grain, std::move(run)};
+    unsigned id = unsigned(stages.size());
+    dependents.emplace_back();
+    dependencies.push_back(0);
+    for (unsigned i = 0; i < id; i++)
+      if (conflict(stages[i], stage)) {
+        dependents[i].push_back(id);
+        dependencies[id]++;
+      }
+    stages.push_back(std::move(stage));
+  }
+
+  void clear() {
+    stages.clear();
+    dependents.clear();
+    dependencies.clear();
+  }
+
+  const std::vector<Stage>& list() const { return stages; }
+
+  // wall time of each stage summed over its chunks, when timing is on
+  bool timing{false};
+  // every chunk as a span on the thread that ran it, when set
+  TraceRecorder* trace{nullptr};
+  // 0 for a stage of a graph that has not run yet
+  double seconds(unsigned stage) const {
+    return stage < nanos.size() ? nanos[stage] * 1e-9 : 0;
+  }
+  void resetTimes() {
+    for (auto& n : nanos) n = 0;
+  }
+
+  void run(ThreadPool& pool) {
+    if (stages.empty()) return;
+    if (pending.size() != stages.size()) {
+      pending = std::vector<std::atomic<int>>(stages.size());
+      chunksLeft = std::vector<std::atomic<int>>(stages.size());
+      nanos = std::vector<std::atomic<int64_t>>(stages.size());
+      resetTimes();
+    }
+    if (trace)
+      for (Stage& stage : stages)
+        if (!stage.traceName) stage.traceName = trace->intern(stage.name);
+    for (unsigned i = 0; i < stages.size(); i++) pending[i] = dependencies[i];
+    stagesLeft = int(stages.size());
+    for (unsigned i = 0; i < stages.size(); i++)
+      if (dependencies[i] == 0) launch(i, pool);
+    pool.helpUntil(stagesLeft);
+  }
+
+ private:
+  static bool conflict(const Stage& a, const Stage& b) {
+    return (a.writes & (b.reads | b.writes)) || (a.reads & b.writes);
+  }
+
+  void launch(unsigned id, ThreadPool& pool) {
+    const Stage& stage = stages[id];
+    unsigned chunks = 1;
+    if (stage.count > 0) {
+      chunks = (stage.count + stage.grain - 1) / stage.grain;
+      chunks = std::max(1u, std::min(chunks, pool.size() * 4));
+    }
+    chunksLeft[id] = int(chunks);
+    unsigned step = stage.count > 0 ? (stage.count + chunks - 1) / chunks : 0;
+    for (unsigned c = 0; c < chunks; c++) {
+      unsigned begin = std::min(stage.count, c * step);
+      unsigned end = std::min(stage.count, begin + step);
+      pool.submit([this, id, begin, end, &pool] {
+        if (trace) {
+          TraceScope scope(*trace, stages[id].traceName);
+          runChunk(id, begin, end);
+        } else {
+          runChunk(id, begin, end);
+        }
+        if (--chunksLeft[id] == 0) finish(id, pool);
+      });
+    }
+  }
+
+  void runChunk(unsigned id, unsigned begin, unsigned end) {
+    if (timing) {
+      auto start = std::chrono::steady_clock::now();
+      stages[id].run(begin, end);
+      nanos[id] += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+    } else {
+      stages[id].run(begin, end);
+    }
+  }
+
+  void finish(unsigned id, ThreadPool& pool) {
+    for (unsigned next : dependents[id])
+      if (--pending[next] == 0) launch(next, pool);
+    --stagesLeft;
+  }
+
+  std::vector<Stage> stages;
+  std::vector<std::vector<unsigned>> dependents;
+  std::vector<int> dependencies;
+  std::vector<std::atomic<int>> pending;
+  std::vector<std::atomic<int>> chunksLeft;
+  std::vector<std::atomic<int64_t>> nanos;
+  std::atomic<int> stagesLeft{0};
+};
@@ -0,0 +1,251 @@
+// MAT201B final project
+// shared-memory transport for renderers on the sender's machine
+//
+// with --shm NAME the sender also publishes every state into a POSIX
+// shared-memory segment; renderers started on the same host with the same
+// flag copy it from there instead of getting it through Cuttlebone (or
+// --stream) and the network stack. a renderer that cannot open the
+// segment (it runs on another machine, or the sender is not up yet) falls
+// back to the network.
+//
+// the segment is a ring of SLOTS copies of the state, each guarded by a
+// seqlock: state n goes into slot n % SLOTS, whose sequence the writer
+// makes odd, then even again once the state is in; only then does the
+// count of states written go up to n. readers never block the writer. a
+// reader walks the ring from the last state it took up to the newest, so
+// one that skips a frame still gets every state (and its update list)
+// unless the writer has lapped it; the states that were overwritten
+// before or while being copied are counted as missed.
+//
+// each state is copied out of its slot (its header.bytes, not the whole
+// State) and handed on only if the sequence did not move meanwhile. it
+// is not used in place: what a reader takes is applied to its Reckoning
+// and snapshots, which cannot be undone if the slot turns out to have
+// been overwritten underneath, so the copy is what makes the check
+// possible. the network is still left out.
+//
+// a sender that restarts unlinks the segment and makes a new one under
+// the same name, which renderers still mapping the old one would never
+// see; once no new state has come for STALE reads they look the name up
+// again and move to the new segment if it is another one.
+
+#pragma once
+
+#include "al/io/al_Imgui.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2,
+              "atomics in shared memory must be lock-free");
+
+template <typename State>
+class SharedMemoryLink {
+ public:
+  enum { SLOTS = 8 };   // states a renderer may fall behind without loss
+  enum { STALE = 60 };  // reads with no new state before the name is checked
+
+  ~SharedMemoryLink() { close(); }
+
+  // sender: a new segment, replacing any left over from an earlier run
+  bool create(const char* name) {
+    close();
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) return false;
+    void* p = MAP_FAILED;
+    if (ftruncate(fd, sizeof(Segment)) == 0)
+      p = mmap(nullptr, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED,
+               fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+      shm_unlink(name);
+      return false;
+    }
+    // a new segment is all zeros: no state written, every sequence even
+    segment = static_cast<Segment*>(p);
+    segment->size = sizeof(State);
+    segment->magic.store(MAGIC, std::memory_order_release);
+    owner = name;
+    return true;
+  }
+
+  // renderer: the sender's segment, if it is up on this machine and was
+  // built with the same State
+  bool open(const char* name) {
+    close();
+    segment = map(name, inode);
+    if (!segment) return false;
+    watched = name;
+    copy.reset(new State);
+    scratch.reset(new State);
+    intact = false;
+    catchUp();
+    return true;
+  }
+
+  bool attached() const { return segment != nullptr; }
+
+  // sender: the first `bytes` of s as the next state
+  void publish(const State& s, size_t bytes) {
+    uint32_t number = segment->written.load(std::memory_order_relaxed) + 1;
+    Slot& slot = segment->slots[number % SLOTS];
+    uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.number.store(number, std::memory_order_relaxed);
+    slot.bytes.store(uint32_t(bytes), std::memory_order_relaxed);
+    std::memcpy(&slot.state, &s, bytes);
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+    segment->written.store(number, std::memory_order_release);
+    published++;
+  }
+
+  // renderer: every state written since the last read, oldest first, each
+  // copied out and passed to accept(const State&) once it is known to be
+  // intact. returns the newest intact copy, which may be from an earlier
+  // read; nullptr until there is one
+  template <typename Accept>
+  const State* read(Accept accept) {
+    uint32_t written = segment->written.load(std::memory_order_acquire);
+    if (written == consumed) {
+      if (++stale >= STALE) reopen();
+      return intact ? copy.get() : nullptr;
+    }
+    stale = 0;
+    if (written - consumed > SLOTS) {  // lapped: the oldest are gone
+      missed += written - consumed - SLOTS;
+      consumed = written - SLOTS;
+    }
+    while (consumed != written) {
+      if (!take(++consumed)) {
+        missed++;
+        continue;
+      }
+      std::swap(copy, scratch);
+      intact = true;
+      accept(*copy);
+    }
+    return intact ? copy.get() : nullptr;
+  }
+
+  void drawPanel(bool sending) {
+    if (!ImGui::CollapsingHeader("shared memory")) return;
+    if (sending) {
+      ImGui::Text("%lu states published", published);
+    } else {
+      ImGui::Text("%lu states overwritten before they were copied",
+                  missed);
+      ImGui::Text("%lu segments of a restarted sender", reopened);
+    }
+  }
+
+  void close() {
+    if (segment) munmap(segment, sizeof(Segment));
+    segment = nullptr;
+    if (!owner.empty()) shm_unlink(owner.c_str());
+    owner.clear();
+  }
+
+  // states written (sender), states lost to the writer and segments moved
+  // to (renderers)
+  unsigned long published{0}, missed{0}, reopened{0};
+
+ private:
+  enum : uint32_t { MAGIC = 0x4d415433 };  // "MAT3"
+
+  struct Slot {
+    alignas(64) std::atomic<uint32_t> sequence;  // odd while being written
+    std::atomic<uint32_t> number;                // of the state held
+    std::atomic<uint32_t> bytes;                 // of state in use
+    State state;
+  };
+
+  struct Segment {
+    std::atomic<uint32_t> magic;  // set once the segment is ready
+    uint32_t size;                // sizeof(State) on the sender
+    alignas(64) std::atomic<uint32_t> written;  // states so far
+    Slot slots[SLOTS];
+  };
+
+  // the segment under name, if it is ready and holds this State
+  static Segment* map(const char* name, ino_t& inode) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return nullptr;
+    struct stat info;
+    void* p = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && size_t(info.st_size) == sizeof(Segment))
+      p = mmap(nullptr, sizeof(Segment), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) return nullptr;
+    Segment* s = static_cast<Segment*>(p);
+    if (s->magic.load(std::memory_order_acquire) != MAGIC ||
+        s->size != sizeof(State)) {
+      munmap(p, sizeof(Segment));
+      return nullptr;
+    }
+    inode = info.st_ino;
+    return s;
+  }
+
+  // renderer: state `number` into scratch; false if its slot holds
+  // another one by now, or was written to while being copied
+  bool take(uint32_t number) {
+    Slot& slot = segment->slots[number % SLOTS];
+    uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+    if (sequence & 1) return false;
+    if (slot.number.load(std::memory_order_relaxed) != number) return false;
+    size_t bytes = std::min(size_t(slot.bytes.load(std::memory_order_relaxed)),
+                            sizeof(State));
+    std::memcpy(scratch.get(), &slot.state, bytes);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.sequence.load(std::memory_order_relaxed) == sequence;
+  }
+
+  // renderer: start from the newest state of the segment just mapped
+  void catchUp() {
+    uint32_t written = segment->written.load(std::memory_order_acquire);
+    consumed = written ? written - 1 : 0;
+    stale = 0;
+  }
+
+  // renderer: move to the segment under the name if the sender replaced
+  // it; while there is none (or it is not ready) keep the old one
+  void reopen() {
+    stale = 0;
+    int fd = shm_open(watched.c_str(), O_RDONLY, 0);
+    if (fd < 0) return;
+    struct stat info;
+    bool same = fstat(fd, &info) != 0 || info.st_ino == inode;
+    ::close(fd);
+    if (same) return;
+    ino_t replaced;
+    Segment* s = map(watched.c_str(), replaced);
+    if (!s) return;
+    munmap(segment, sizeof(Segment));
+    segment = s;
+    inode = replaced;
+    catchUp();
+    reopened++;
+  }
+
+  Segment* segment{nullptr};
+  std::string owner;    // the name to unlink, on the sender
+  std::string watched;  // the name opened, on a renderer
+  ino_t inode{0};       // of the segment mapped, on a renderer
+  std::unique_ptr<State> copy;     // the newest intact state taken
+  std::unique_ptr<State> scratch;  // the state being copied
+  bool intact{false};              // copy holds a state
+  uint32_t consumed{0};            // the number of the last state taken
+  unsigned stale{0};
+};
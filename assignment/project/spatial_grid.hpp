@@ -0,0 +1,161 @@
+// MAT201B final project
+// uniform grid over the unit cube for the species' neighbour queries
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// the world is the unit cube with opposite faces glued together, so the
+// offset between two coordinates is the shortest one around the torus,
+// in [-0.5, 0.5)
+template <typename T>
+T minimumImage(T d) {
+  return d - std::floor(d + T(0.5));
+}
+
+// cells per axis that make a search of `radius` among `agents` evenly
+// spread agents cheapest, counting a visited cell and a candidate distance
+// test as about the same work. too few cells and every query tests most of
+// the population, too many and it walks rows of empty cells.
+inline unsigned chooseResolution(unsigned agents, float radius,
+                                 unsigned maxResolution = 96) {
+  unsigned best = 1;
+  double bestCost = 0;
+  for (unsigned res = 1; res <= maxResolution; res++) {
+    double reach = std::ceil(double(radius) * res);
+    double side = std::min(2 * reach + 1, double(res));
+    double cells = side * side * side;
+    double cost = cells + cells * agents / (double(res) * res * res);
+    if (res == 1 || cost < bestCost) {
+      best = res;
+      bestCost = cost;
+    }
+  }
+  return best;
+}
+
+// every agent sits in one cell's doubly linked list, like al::HashSpace,
+// but moving an agent that stays inside its cell only costs the cell
+// lookup: the unlink/relink is skipped. cells wrap around the cube, so
+// positions outside [0, 1) land in the cell they wrap to.
+class SpatialGrid {
+ public:
+  // an empty grid for `agents` agents with `resolution` cells per axis;
+  // the counters below start over, so they describe this resolution
+  void resize(unsigned agents, unsigned resolution) {
+    res = std::max(1u, resolution);
+    moves = relinks = 0;
+    queries = candidates = 0;
+    head.assign(size_t(res) * res * res, NONE);
+    next.assign(agents, NONE);
+    prev.assign(agents, NONE);
+    cell.assign(agents, NONE);
+  }
+
+  unsigned resolution() const { return res; }
+  unsigned size() const { return unsigned(cell.size()); }
+
+  // cell index along one axis, wrapped into [0, res)
+  int axis(float x) const {
+    int c = int(std::floor(x * res)) % int(res);
+    return c < 0 ? c + int(res) : c;
+  }
+
+  unsigned cellOf(float x, float y, float z) const {
+    return index(axis(x), axis(y), axis(z));
+  }
+
+  unsigned index(int x, int y, int z) const {
+    return (unsigned(z) * res + unsigned(y)) * res + unsigned(x);
+  }
+
+  // put agent i at (x, y, z), relinking only if it changed cell
+  void move(unsigned i, float x, float y, float z) {
+    moves++;
+    uint32_t c = cellOf(x, y, z);
+    if (c == cell[i]) return;
+    relinks++;
+    unlink(i);
+    link(i, c);
+  }
+
+  // call visit(j) for every agent in a cell the sphere of `radius` around
+  // (x, y, z) overlaps, including cells across the faces of the cube; the
+  // caller does the exact (minimum image) distance test
+  // returns how many candidates it visited
+  template <typename Visit>
+  unsigned forEachCandidate(float x, float y, float z, float radius,
+                            Visit visit) const {
+    unsigned visited = 0;
+    int reach = int(std::ceil(radius * res));
+    int cx = axis(x), cy = axis(y), cz = axis(z);
+    // a reach that covers the whole axis visits each cell once, not twice
+    int lo = -reach, hi = reach;
+    if (2 * reach + 1 >= int(res)) {
+      lo = 0;
+      hi = int(res) - 1;
+      cx = cy = cz = 0;
+    }
+    for (int dz = lo; dz <= hi; dz++)
+      for (int dy = lo; dy <= hi; dy++)
+        for (int dx = lo; dx <= hi; dx++) {
+          uint32_t j = head[index(wrap(cx + dx), wrap(cy + dy), wrap(cz + dz))];
+          for (; j != NONE; j = next[j], visited++) visit(j);
+        }
+    return visited;
+  }
+
+  // searches add up their work here, once per batch; safe from any thread
+  void record(unsigned long searches, unsigned long visited) const {
+    queries += searches;
+    candidates += visited;
+  }
+
+  double candidatesPerQuery() const {
+    return queries ? double(candidates) / queries : 0.0;
+  }
+
+  // index maintenance since the last resize: calls to move, and how many
+  // of them actually changed cell (placing every agent after a resize
+  // counts as one of each)
+  unsigned long moves{0};
+  unsigned long relinks{0};
+  // queries answered since the last resize, and candidates they tested
+  mutable std::atomic<unsigned long> queries{0};
+  mutable std::atomic<unsigned long> candidates{0};
+
+ private:
+  enum : uint32_t { NONE = 0xffffffffu };
+
+  int wrap(int c) const {
+    c %= int(res);
+    return c < 0 ? c + int(res) : c;
+  }
+
+  void link(uint32_t i, uint32_t c) {
+    cell[i] = c;
+    prev[i] = NONE;
+    next[i] = head[c];
+    if (head[c] != NONE) prev[head[c]] = i;
+    head[c] = i;
+  }
+
+  void unlink(uint32_t i) {
+    if (cell[i] == NONE) return;
+    if (prev[i] != NONE)
+      next[prev[i]] = next[i];
+    else
+      head[cell[i]] = next[i];
+    if (next[i] != NONE) prev[next[i]] = prev[i];
+    cell[i] = NONE;
+  }
+
+  unsigned res{1};
+  std::vector<uint32_t> head;  // first agent in each cell
+  std::vector<uint32_t> next, prev;
+  std::vector<uint32_t> cell;  // the cell each agent is linked into
+};
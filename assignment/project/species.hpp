@@ -0,0 +1,394 @@
+// MAT201B final project
+// structure-of-arrays storage shared by every species in the ecosystem
+
+#pragma once
+
+#include "al/math/al_Quat.hpp"
+#include "al/math/al_Vec.hpp"
+#include "al/graphics/al_Mesh.hpp"
+#include "../fixed_step.hpp"
+#include "../wire_format.hpp"
+#include "spatial_grid.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// one population of agents; every attribute lives in its own contiguous
+// array so each update stage streams only the data it touches
+template <typename T>
+struct Species {
+  typedef al::Vec<3, T> Vec3;
+  typedef al::Quat<T> Quat;
+
+  unsigned n{0};
+  std::vector<T> px, py, pz;      // position
+  std::vector<T> ox, oy, oz;      // position at the previous step
+  std::vector<T> qw, qx, qy, qz;  // orientation
+  std::vector<T> vx, vy, vz;      // velocity
+  std::vector<T> ax, ay, az;      // acceleration
+  std::vector<T> hx, hy, hz;      // heading of the local flock
+  std::vector<T> cx, cy, cz;      // center of the local flock
+  std::vector<unsigned> flockCount;
+
+  void resize(unsigned count) {
+    n = count;
+    for (auto* a : {&px, &py, &pz, &ox, &oy, &oz, &vx, &vy, &vz, &ax, &ay,
+                    &az, &hx, &hy, &hz, &cx, &cy, &cz, &qx, &qy, &qz})
+      a->assign(n, T(0));
+    qw.assign(n, T(1));
+    flockCount.assign(n, 1);
+  }
+
+  unsigned size() const { return n; }
+
+  Vec3 pos(unsigned i) const { return Vec3(px[i], py[i], pz[i]); }
+  void pos(unsigned i, const Vec3& p) {
+    px[i] = p.x;
+    py[i] = p.y;
+    pz[i] = p.z;
+  }
+
+  // move without leaving a trail for the renderer to interpolate along
+  void teleport(unsigned i, const Vec3& p) {
+    pos(i, p);
+    ox[i] = p.x;
+    oy[i] = p.y;
+    oz[i] = p.z;
+  }
+
+  Quat quat(unsigned i) const { return Quat(qw[i], qx[i], qy[i], qz[i]); }
+  void quat(unsigned i, const Quat& q) {
+    qw[i] = q.w;
+    qx[i] = q.x;
+    qy[i] = q.y;
+    qz[i] = q.z;
+  }
+
+  Vec3 heading(unsigned i) const { return Vec3(hx[i], hy[i], hz[i]); }
+  Vec3 center(unsigned i) const { return Vec3(cx[i], cy[i], cz[i]); }
+  Vec3 velocity(unsigned i) const { return Vec3(vx[i], vy[i], vz[i]); }
+
+  // same conventions as al::Pose
+  Vec3 uf(unsigned i) const { return -quat(i).toVectorZ(); }
+  Vec3 uu(unsigned i) const { return quat(i).toVectorY(); }
+
+  void faceToward(unsigned i, const Vec3& point, T amt = T(1)) {
+    Vec3 target(point - pos(i));
+    target.normalize();
+    Quat rot = Quat::getRotationTo(uf(i), target);
+    Quat q = (amt == T(1) ? rot : rot.pow(amt)) * quat(i);
+    quat(i, q.normalize());
+  }
+
+  // renumber: agent i becomes what agent order[i] was
+  void permute(const std::vector<unsigned>& order) {
+    std::vector<T> moved(n);
+    for (auto* a : {&px, &py, &pz, &ox, &oy, &oz, &qw, &qx, &qy, &qz, &vx,
+                    &vy, &vz, &ax, &ay, &az, &hx, &hy, &hz, &cx, &cy, &cz}) {
+      for (unsigned i = 0; i < n; i++) moved[i] = (*a)[order[i]];
+      a->swap(moved);
+    }
+    std::vector<unsigned> counts(n);
+    for (unsigned i = 0; i < n; i++) counts[i] = flockCount[order[i]];
+    flockCount.swap(counts);
+  }
+};
+
+// scatter a fresh population and put it in the index; rv(i, 0) is where
+// agent i starts and rv(i, 1) a point it faces
+template <typename T, typename Random>
+void initSpecies(Species<T>& s, unsigned count, SpatialGrid& grid,
+                 unsigned resolution, Random rv) {
+  s.resize(count);
+  grid.resize(count, resolution);
+  for (unsigned i = 0; i < count; i++) {
+    s.teleport(i, rv(i, 0));
+    grid.move(i, s.px[i], s.py[i], s.pz[i]);
+    s.faceToward(i, rv(i, 1));
+  }
+}
+
+// one point per agent; visualizeBlocks (interest.hpp) fills them in every
+// frame
+inline void allocateMesh(al::Mesh& mesh, unsigned count) {
+  mesh.reset();
+  for (unsigned i = 0; i < count; i++) {
+    mesh.vertex(al::Vec3f(0, 0, 0));
+    mesh.normal(al::Vec3f(0, 0, -1));
+    mesh.color(0, 1, 0);
+  }
+}
+
+// the stages below work on agents [begin, end) so the scheduler can split
+// them into chunks; by default they cover the whole species
+
+// keep the pose of the last step for render interpolation
+template <typename T>
+void rememberSpecies(Species<T>& s, unsigned begin = 0, unsigned end = ~0u) {
+  end = std::min(end, s.n);
+  std::copy(s.px.begin() + begin, s.px.begin() + end, s.ox.begin() + begin);
+  std::copy(s.py.begin() + begin, s.py.begin() + end, s.oy.begin() + begin);
+  std::copy(s.pz.begin() + begin, s.pz.begin() + end, s.oz.begin() + begin);
+}
+
+// start of a step: each agent is a flock of one
+template <typename T>
+void setSpecies(Species<T>& s, unsigned begin = 0, unsigned end = ~0u) {
+  end = std::min(end, s.n);
+  for (unsigned i = begin; i < end; i++) {
+    al::Vec<3, T> f = s.uf(i);
+    s.cx[i] = s.px[i];
+    s.cy[i] = s.py[i];
+    s.cz[i] = s.pz[i];
+    s.hx[i] = f.x;
+    s.hy[i] = f.y;
+    s.hz[i] = f.z;
+    s.flockCount[i] = 1;
+    s.ax[i] = s.ay[i] = s.az[i] = T(0);
+  }
+}
+
+// neighbour lists in compressed sparse row form: the neighbours of agent i
+// are ids[offsets[i]] .. ids[offsets[i + 1] - 1]. the storage is kept from
+// frame to frame, so after the first frame a search allocates nothing.
+struct Neighbours {
+  std::vector<unsigned> offsets;  // n + 1 entries
+  std::vector<unsigned> ids;
+  std::vector<unsigned> counts;   // per agent, before compaction
+  unsigned k{0};
+  enum { MAX_K = 64 };
+
+  // room for n agents with up to k (at most MAX_K) neighbours each
+  void reserve(unsigned n, unsigned maxNeighbours) {
+    k = std::min(maxNeighbours, unsigned(MAX_K));
+    counts.resize(n);
+    offsets.resize(n + 1);
+    if (ids.size() < size_t(n) * k) ids.resize(size_t(n) * k);
+  }
+
+  unsigned size() const { return unsigned(counts.size()); }
+  unsigned begin(unsigned i) const { return offsets[i]; }
+  unsigned end(unsigned i) const { return offsets[i + 1]; }
+};
+
+// find the k nearest flockmates within `radius` of agents [begin, end) in
+// one batch, nearest first. each agent's results go to its own k-wide slot
+// of ids, so chunks can search in parallel; compactNeighbours packs the
+// slots afterwards.
+template <typename T>
+void searchNeighbours(const Species<T>& s, const SpatialGrid& grid,
+                      T radius, Neighbours& out, unsigned begin = 0,
+                      unsigned end = ~0u) {
+  const T radius2 = radius * radius;
+  T best[Neighbours::MAX_K];  // squared distances, parallel to the slot
+  unsigned long visited = 0;
+  end = std::min(end, s.n);
+  for (unsigned i = begin; i < end; i++) {
+    unsigned* slot = &out.ids[size_t(i) * out.k];
+    unsigned found = 0;
+    T x = s.px[i], y = s.py[i], z = s.pz[i];
+    visited += grid.forEachCandidate(x, y, z, radius, [&](unsigned j) {
+      if (j == i) return;
+      T dx = minimumImage(s.px[j] - x);
+      T dy = minimumImage(s.py[j] - y);
+      T dz = minimumImage(s.pz[j] - z);
+      T d2 = dx * dx + dy * dy + dz * dz;
+      if (d2 >= radius2) return;
+      if (found == out.k && d2 >= best[found - 1]) return;
+      // insertion into the sorted slot, dropping the farthest when full
+      unsigned r = found < out.k ? found++ : found - 1;
+      for (; r > 0 && best[r - 1] > d2; r--) {
+        best[r] = best[r - 1];
+        slot[r] = slot[r - 1];
+      }
+      best[r] = d2;
+      slot[r] = j;
+    });
+    out.counts[i] = found;
+  }
+  grid.record(end > begin ? end - begin : 0, visited);
+}
+
+// close the gaps between slots so the lists are contiguous
+inline void compactNeighbours(Neighbours& out) {
+  unsigned n = out.size();
+  unsigned total = 0;
+  for (unsigned i = 0; i < n; i++) {
+    size_t slot = size_t(i) * out.k;
+    out.offsets[i] = total;
+    // slots only ever move left, so a forward copy is safe
+    if (slot != total)
+      std::copy(out.ids.begin() + slot, out.ids.begin() + slot + out.counts[i],
+                out.ids.begin() + total);
+    total += out.counts[i];
+  }
+  out.offsets[n] = total;
+}
+
+// accumulate heading and center over each agent's neighbour list. a
+// flockmate across a face of the cube counts where it appears from the
+// agent, so a flock straddling the seam has its center at the seam
+template <typename T>
+void flockSpecies(Species<T>& s, const Neighbours& neighbours,
+                  unsigned begin = 0, unsigned end = ~0u) {
+  end = std::min(end, s.n);
+  for (unsigned i = begin; i < end; i++) {
+    T x = s.px[i], y = s.py[i], z = s.pz[i];
+    for (unsigned r = neighbours.begin(i); r < neighbours.end(i); r++) {
+      unsigned id = neighbours.ids[r];
+      al::Vec<3, T> f = s.uf(id);
+      s.hx[i] += f.x;
+      s.hy[i] += f.y;
+      s.hz[i] += f.z;
+      s.cx[i] += x + minimumImage(s.px[id] - x);
+      s.cy[i] += y + minimumImage(s.py[id] - y);
+      s.cz[i] += z + minimumImage(s.pz[id] - z);
+    }
+    s.flockCount[i] += neighbours.end(i) - neighbours.begin(i);
+  }
+}
+
+// visit every agent of `target` within `radius` of `p` through the target's
+// index, so a pass of species A against species B only touches B's local
+// neighbourhood. the distance test uses the live positions in case an
+// earlier pass respawned an agent this frame, measured around the torus.
+template <typename T, typename Visit>
+void forEachNear(const Species<T>& target, const SpatialGrid& grid,
+                 const al::Vec<3, T>& p, T radius, Visit visit) {
+  const T radius2 = radius * radius;
+  unsigned visited =
+      grid.forEachCandidate(p.x, p.y, p.z, radius, [&](unsigned j) {
+        T dx = minimumImage(target.px[j] - p.x);
+        T dy = minimumImage(target.py[j] - p.y);
+        T dz = minimumImage(target.pz[j] - p.z);
+        if (dx * dx + dy * dy + dz * dz < radius2) visit(j);
+      });
+  grid.record(1, visited);
+}
+
+// steer along, toward and away from the local flock
+template <typename T>
+void alignSpecies(Species<T>& s, T turnRate, unsigned begin = 0,
+                  unsigned end = ~0u) {
+  typedef al::Vec<3, T> Vec3;
+  end = std::min(end, s.n);
+  for (unsigned i = begin; i < end; i++) {
+    if (s.flockCount[i] < 1) {
+      printf("ERROR");
+      fflush(stdout);
+      exit(1);
+    }
+
+    if (s.flockCount[i] == 1) {
+      s.faceToward(i, Vec3(0, 0, 0), T(0.003) * turnRate);
+      continue;
+    }
+
+    T count = T(s.flockCount[i]);
+    s.cx[i] /= count;
+    s.cy[i] /= count;
+    s.cz[i] /= count;
+    s.hx[i] /= count;
+    s.hy[i] /= count;
+    s.hz[i] /= count;
+
+    Vec3 p = s.pos(i);
+    Vec3 center = s.center(i);
+    s.faceToward(i, p + s.heading(i), T(0.003) * turnRate);
+    s.faceToward(i, center, T(0.003) * turnRate);
+    s.faceToward(i, s.pos(i) - center, T(0.003) * turnRate);
+  }
+}
+
+// thrust along the forward vector with linear drag
+template <typename T>
+void accelerateSpecies(Species<T>& s, T moveRate, unsigned begin = 0,
+                       unsigned end = ~0u) {
+  const T thrust = moveRate * T(0.002);
+  const T* qw = s.qw.data();
+  const T* qx = s.qx.data();
+  const T* qy = s.qy.data();
+  const T* qz = s.qz.data();
+  end = std::min(end, s.n);
+  for (unsigned i = begin; i < end; i++) {
+    // uf() = -toVectorZ(), expanded so the loop stays branch free
+    T fx = -2 * (qx[i] * qz[i] + qy[i] * qw[i]);
+    T fy = -2 * (qy[i] * qz[i] - qx[i] * qw[i]);
+    T fz = -(1 - 2 * (qx[i] * qx[i] + qy[i] * qy[i]));
+    s.ax[i] += fx * thrust - s.vx[i] * T(0.1);
+    s.ay[i] += fy * thrust - s.vy[i] * T(0.1);
+    s.az[i] += fz * thrust - s.vz[i] * T(0.1);
+  }
+}
+
+// velocity and acceleration are per 60 Hz frame; h scales them to the
+// length of the step (h = 1 at 60 Hz)
+template <typename T>
+void integrateSpecies(Species<T>& s, T h = T(1), unsigned begin = 0,
+                      unsigned end = ~0u) {
+  end = std::min(end, s.n);
+  for (unsigned i = begin; i < end; i++) {
+    s.vx[i] += s.ax[i] * h;
+    s.vy[i] += s.ay[i] * h;
+    s.vz[i] += s.az[i] * h;
+    s.px[i] += s.vx[i] * h;
+    s.py[i] += s.vy[i] * h;
+    s.pz[i] += s.vz[i] * h;
+  }
+}
+
+// wrap the unit cube into a torus
+template <typename T>
+void wrapSpecies(Species<T>& s, unsigned begin = 0, unsigned end = ~0u) {
+  end = std::min(end, s.n);
+  for (auto* a : {&s.px, &s.py, &s.pz}) {
+    T* p = a->data();
+    for (unsigned i = begin; i < end; i++) {
+      if (p[i] > 1) p[i] -= 1;
+      if (p[i] < 0) p[i] += 1;
+    }
+  }
+}
+
+// relinking touches neighbours in the cell lists, so the index is
+// refreshed in one piece; most agents stay in their cell and cost a lookup
+template <typename T>
+void reindexSpecies(const Species<T>& s, SpatialGrid& grid) {
+  for (unsigned i = 0; i < s.n; i++) grid.move(i, s.px[i], s.py[i], s.pz[i]);
+}
+
+// move the whole species into a grid of a new resolution
+template <typename T>
+void regridSpecies(const Species<T>& s, SpatialGrid& grid,
+                   unsigned resolution) {
+  grid.resize(s.n, resolution);
+  reindexSpecies(s, grid);
+}
+
+template <typename T>
+void makespaceSpecies(Species<T>& s, SpatialGrid& grid) {
+  wrapSpecies(s);
+  reindexSpecies(s, grid);
+}
+
+// publish poses blended alpha of the way from the previous step; an agent
+// that wrapped around the cube is drawn where it is now
+template <typename T>
+void distributeSpecies(const Species<T>& s, PackedPose* out,
+                       const WorldBounds& bounds, T alpha = 1,
+                       unsigned begin = 0, unsigned end = ~0u) {
+  typedef al::Vec<3, T> Vec3;
+  end = std::min(end, s.n);
+  for (unsigned i = begin; i < end; i++) {
+    Vec3 current = s.pos(i);
+    Vec3 previous(s.ox[i], s.oy[i], s.oz[i]);
+    Vec3 jump = current - previous;
+    bool wrapped = std::abs(jump.x) > T(0.5) || std::abs(jump.y) > T(0.5) ||
+                   std::abs(jump.z) > T(0.5);
+    Vec3 position = wrapped ? current : interpolate(previous, current, alpha);
+    out[i] = packPose(position, s.quat(i), bounds);
+  }
+}
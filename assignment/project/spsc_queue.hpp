@@ -0,0 +1,52 @@
+// MAT201B final project
+// bounded lock-free queue between exactly one producer and one consumer
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// the producer only writes `tail` and the consumer only writes `head`, so
+// neither side ever waits on the other; a full queue refuses the push
+// instead of blocking. Capacity must be a power of two; the items are
+// on the heap, so a queue of whole states does not sit in its owner.
+template <typename T, size_t Capacity>
+class SpscQueue {
+  static_assert((Capacity & (Capacity - 1)) == 0,
+                "capacity must be a power of two");
+
+ public:
+  SpscQueue() : items(Capacity) {}
+
+  // producer side
+  bool push(const T& item) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == Capacity) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    items[t & (Capacity - 1)] = item;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // consumer side
+  bool pop(T& item) {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) return false;
+    item = items[h & (Capacity - 1)];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  // pushes refused because the consumer fell behind
+  unsigned long droppedCount() const { return dropped.load(); }
+
+ private:
+  std::vector<T> items;
+  // on separate cache lines so the two threads do not false-share
+  alignas(64) std::atomic<size_t> head{0};
+  alignas(64) std::atomic<size_t> tail{0};
+  alignas(64) std::atomic<unsigned long> dropped{0};
+};
@@ -0,0 +1,125 @@
+// MAT201B final project
+// compressed state stream: the state goes out through state_codec.hpp
+// instead of Cuttlebone
+//
+// Cuttlebone broadcasts all of SharedState, raw, every frame. with
+// --stream ADDRESS the sender encodes the part in use (header.bytes) of
+// each state it publishes, XORed against the last keyframe, and sends the
+// packet to ADDRESS in SnapshotChunks (lockstep.hpp) on one OSC address,
+//
+//   /state/chunk  a SnapshotChunk, header and the bytes used
+//
+// renderers put each packet back together and decode it into state(),
+// getting the sender's exact bytes or nothing. chunks are queued for the
+// main thread like the lockstep ones, in a queue sized for the State the
+// stream carries.
+
+#pragma once
+
+#include "al/io/al_Imgui.hpp"
+#include "al/protocol/al_OSC.hpp"
+#include "../state_codec.hpp"
+#include "lockstep.hpp"
+#include "spsc_queue.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// chunks queued for the main thread: two keyframes of a whole state (a
+// packet is at most a few bytes longer than the state), so one frame that
+// runs late drops nothing, rounded up to a power of two
+constexpr size_t chunkQueueFor(size_t stateBytes) {
+  size_t packet = stateBytes + sizeof(CodecHeader) + 64;
+  size_t chunks = 2 * ((packet + SnapshotChunk::CAPACITY - 1) /
+                       SnapshotChunk::CAPACITY);
+  size_t capacity = 1;
+  while (capacity < chunks) capacity *= 2;
+  return capacity;
+}
+
+template <typename State>
+class StateStream : public al::osc::PacketHandler {
+ public:
+  bool send(const char* address, uint16_t port) {
+    return sender.open(port, address);
+  }
+
+  bool listen(uint16_t port) {
+    if (!receiver.open(port)) return false;
+    receiver.handler(*this);
+    return receiver.start();
+  }
+
+  // sender: the state in all its chunks at once, so a renderer never waits
+  // a frame for the rest of one
+  void sendState(const void* state, size_t bytes) {
+    encoder.encode(state, bytes, packet);
+    size_t capacity = SnapshotChunk::CAPACITY;
+    unsigned chunks = unsigned((packet.size() + capacity - 1) / capacity);
+    for (unsigned index = 0; index < chunks; index++)
+      sendChunk(sender, "/state/chunk", encoder.encoded, packet, index,
+                chunk);
+    chunksSent += chunks;
+  }
+
+  // receiver, main thread: every state that came in whole since the last
+  // call, oldest first, each decoded into out and then handed to
+  // decoded(). each one matters: an update list left out leaves its
+  // agents wrong until the refresh. false if none came
+  template <typename Decoded>
+  bool receiveState(void* out, size_t capacity, Decoded decoded) {
+    bool got = false;
+    SnapshotChunk c;
+    while (chunks.pop(c)) {
+      packets.add(c);
+      if (!packets.complete() || packets.frame == decodedFrame) continue;
+      decodedFrame = packets.frame;
+      if (!decoder.decode(packets.bytes.data(), packets.bytes.size(), out,
+                          capacity))
+        continue;
+      got = true;
+      decoded();
+    }
+    return got;
+  }
+
+  // receiving thread
+  void onMessage(al::osc::Message& m) override {
+    al::osc::Blob blob;
+    if (m.typeTags() != "b" || m.addressPattern() != "/state/chunk") return;
+    m >> blob;
+    if (readChunk(blob, received)) chunks.push(received);
+  }
+
+  void drawPanel(bool sending) {
+    if (!ImGui::CollapsingHeader("stream")) return;
+    if (sending) {
+      double ratio = encoder.rawBytes ? double(encoder.packedBytes) /
+                                            encoder.rawBytes
+                                      : 0.0;
+      ImGui::Text("%lu states (%lu keyframes), %.1f%% of raw", encoder.encoded,
+                  encoder.keyframes, ratio * 100);
+      ImGui::Text("%lu chunks sent", chunksSent);
+    } else {
+      ImGui::Text("%lu decoded, %lu without a keyframe, %lu damaged",
+                  decoder.decoded, decoder.unkeyed, decoder.corrupt);
+      ImGui::Text("%lu chunks dropped by a full queue",
+                  chunks.droppedCount());
+    }
+  }
+
+  StateEncoder encoder;
+  StateDecoder decoder;
+  unsigned long chunksSent{0};
+
+ private:
+  al::osc::Send sender;
+  al::osc::Recv receiver;
+  std::vector<uint8_t> packet;  // sender, the one going out
+  SnapshotChunk chunk;          // sender, scratch
+  SnapshotChunk received;       // receiving thread
+  SpscQueue<SnapshotChunk, chunkQueueFor(sizeof(State))> chunks;
+  SnapshotAssembler packets;    // main thread
+  uint32_t decodedFrame{0};
+};
@@ -0,0 +1,136 @@
+// MAT201B final project
+// preallocated polyphonic sample playback for the audio callback
+
+#pragma once
+
+#include "al/sound/al_SoundFile.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// a sound file folded down to one channel once, at load time
+struct Sample {
+  std::vector<float> data;
+  float rate{44100};  // frames per second
+
+  bool load(const char* fileName) {
+    al::SoundFile file;
+    if (!file.open(fileName)) return false;
+    int channels = std::max(1, file.channels);
+    unsigned frames = unsigned(file.data.size() / channels);
+    data.assign(frames, 0.0f);
+    for (unsigned i = 0; i < frames; i++) {
+      for (int c = 0; c < channels; c++) data[i] += file.data[i * channels + c];
+      data[i] /= channels;
+    }
+    rate = float(file.sampleRate);
+    return true;
+  }
+
+  // the first `seconds` of this one, faded out over its last quarter so
+  // the cut does not click
+  Sample excerpt(float seconds) const {
+    Sample part;
+    part.rate = rate;
+    unsigned frames = std::min(unsigned(data.size()), unsigned(seconds * rate));
+    part.data.assign(data.begin(), data.begin() + frames);
+    unsigned fade = frames / 4;
+    for (unsigned i = 0; i < fade; i++)
+      part.data[frames - 1 - i] *= float(i) / fade;
+    return part;
+  }
+};
+
+// the mix of every voice may add up well past full scale: the limiter at
+// the end of the chain, linear near zero and never past -1..1
+inline float softClip(float x) { return std::tanh(x); }
+
+// add n samples of `in` into the two buffers. a plain multiply-add over
+// contiguous floats, which the compiler turns into SIMD
+inline void mixSamples(const float* __restrict in, float gainLeft,
+                       float gainRight, float* __restrict left,
+                       float* __restrict right, unsigned n) {
+  for (unsigned i = 0; i < n; i++) {
+    left[i] += in[i] * gainLeft;
+    right[i] += in[i] * gainRight;
+  }
+}
+
+// one playing instance of a sample
+struct Voice {
+  const float* data{nullptr};
+  unsigned length{0};
+  unsigned position{0};
+  float left{0}, right{0};  // gain per channel, pan already applied
+  unsigned long started{0};  // for stealing the oldest voice
+  bool loop{false};  // start over at the end instead of stopping
+
+  bool active() const { return position < length; }
+
+  // pan is -1 (left) to 1 (right), equal power
+  void start(const Sample& sample, float gain, float pan) {
+    float angle = (std::min(1.0f, std::max(-1.0f, pan)) + 1) * 0.78539816f;
+    data = sample.data.data();
+    length = unsigned(sample.data.size());
+    position = 0;
+    left = gain * std::cos(angle);
+    right = gain * std::sin(angle);
+  }
+
+  // add the next `frames` samples into the two buffers
+  void mix(float* mixLeft, float* mixRight, unsigned frames) {
+    unsigned done = 0;
+    while (done < frames && active()) {
+      unsigned n = std::min(frames - done, length - position);
+      mixSamples(data + position, left, right, mixLeft + done,
+                 mixRight + done, n);
+      position += n;
+      done += n;
+      if (loop && position == length) position = 0;
+    }
+  }
+};
+
+// a fixed set of voices mixed a block at a time; nothing here allocates, so
+// it is safe to use from the audio callback. when every voice is busy the
+// one that has played longest is restarted with the new sound.
+template <unsigned MaxVoices>
+class VoicePool {
+ public:
+  // pan is -1 (left) to 1 (right), equal power
+  void play(const Sample& sample, float gain, float pan) {
+    if (sample.data.empty()) return;
+    Voice* voice = &voices[0];
+    for (unsigned v = 0; v < MaxVoices; v++) {
+      if (!voices[v].active()) {
+        voice = &voices[v];
+        break;
+      }
+      if (voices[v].started < voice->started) voice = &voices[v];
+    }
+    if (voice->active()) stolen++;
+    voice->start(sample, gain, pan);
+    voice->started = ++counter;
+  }
+
+  // add `frames` samples of every active voice into the two buffers
+  void mix(float* left, float* right, unsigned frames) {
+    for (unsigned v = 0; v < MaxVoices; v++) voices[v].mix(left, right, frames);
+  }
+
+  unsigned playing() const {
+    unsigned count = 0;
+    for (unsigned v = 0; v < MaxVoices; v++) count += voices[v].active();
+    return count;
+  }
+
+  unsigned long stolenCount() const { return stolen; }
+
+  static unsigned size() { return MaxVoices; }
+
+ private:
+  Voice voices[MaxVoices];
+  unsigned long counter{0};
+  unsigned long stolen{0};
+};
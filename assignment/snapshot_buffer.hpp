@@ -0,0 +1,167 @@
+// MAT201B
+// smooth motion on renderers: the last few states, drawn a fixed delay
+// behind the newest one and blended between the two that bracket it
+//
+// a renderer that draws whatever state() holds when onAnimate runs shows
+// every bit of network jitter, as stutter and as frames drawn twice. so
+// each new state's poses go in here, stamped with the simulated time they
+// are for,
+//
+//   if (!buffer.holds(time)) {
+//     unsigned slot = buffer.push(time, layout, count);
+//     ... fill buffer[slot].position and .orientation ...
+//   }
+//   buffer.advance(dt);                    // once per frame
+//   buffer.draw(first, count, mesh, at);   // poses at the playback time
+//
+// and are drawn at a playback time that runs with the frame clock and is
+// slewed to stay `delay` behind the newest state. positions are lerped and
+// orientations slerped between the states either side of it, so the sender
+// can publish less often than renderers draw. agents that moved more than
+// `jump` between them (respawned, wrapped around) are not blended, nor are
+// states whose agents are numbered differently (layout).
+
+#pragma once
+
+#include "al/graphics/al_Mesh.hpp"
+#include "al/io/al_Imgui.hpp"
+#include "al/math/al_Quat.hpp"
+#include "al/math/al_Vec.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+class SnapshotBuffer {
+ public:
+  enum { CAPACITY = 8 };  // states kept, enough for 0.1 s of 60 Hz states
+
+  struct Snapshot {
+    double time{0};       // simulated seconds the poses are for
+    uint32_t layout{0};   // how agents are numbered
+    std::vector<al::Vec3f> position;
+    std::vector<al::Quatf> orientation;
+  };
+
+  float delay{0.05f};  // seconds the playback time stays behind the newest
+  float jump{0.25f};   // agents moving further between states are not blended
+
+  // whether the newest state kept is the one for `time`
+  bool holds(double time) const { return held > 0 && newest().time == time; }
+  bool empty() const { return held == 0; }
+
+  // room for a new state's poses; the oldest is dropped to make it. a
+  // state from before the newest one (the sender started over) or with
+  // another number of agents clears what was kept
+  unsigned push(double time, uint32_t layout, unsigned agents) {
+    if (held > 0 && (time < newest().time ||
+                     newest().position.size() != agents))
+      held = 0;
+    head = (head + 1) % CAPACITY;
+    if (held < CAPACITY) held++;
+    Snapshot& s = snapshots[head];
+    s.time = time;
+    s.layout = layout;
+    s.position.resize(agents);
+    s.orientation.resize(agents);
+    return head;
+  }
+
+  Snapshot& operator[](unsigned slot) { return snapshots[slot]; }
+  const Snapshot& operator[](unsigned slot) const { return snapshots[slot]; }
+
+  // move the playback time on by a frame and find the states around it
+  void advance(double dt) {
+    if (held == 0) return;
+    double target = newest().time - delay;
+    playback += dt;
+    // far off (the first state, a stall, a change of delay): go straight
+    // there; otherwise take up a tenth of the difference each frame so
+    // drift between the clocks never shows as a jump
+    double behind = target - playback;
+    if (std::abs(behind) > 0.25) {
+      playback = target;
+      resynced++;
+    } else {
+      playback += 0.1 * behind;
+    }
+    from = to = oldestSlot();
+    amount = 0;
+    if (playback >= newest().time) {
+      from = to = head;
+      starved++;  // nothing newer to blend towards
+      return;
+    }
+    for (unsigned n = 1; n < held; n++) {
+      unsigned next = (oldestSlot() + n) % CAPACITY;
+      if (snapshots[next].time > playback) {
+        to = next;
+        double span = snapshots[to].time - snapshots[from].time;
+        amount = float(std::max(0.0, (playback - snapshots[from].time) / span));
+        return;
+      }
+      from = to = next;
+    }
+  }
+
+  // the states the playback time falls between; draw() blends them when
+  // blends(), and otherwise draws the later one
+  unsigned older() const { return from; }
+  unsigned later() const { return to; }
+  bool blends() const {
+    return from != to && snapshots[from].layout == snapshots[to].layout;
+  }
+
+  // agents [first, first + count) at the playback time, into the mesh from
+  // vertex `at`
+  void draw(unsigned first, unsigned count, al::Mesh& mesh,
+            unsigned at) const {
+    std::vector<al::Vec3f>& v(mesh.vertices());
+    std::vector<al::Vec3f>& n(mesh.normals());
+    std::vector<al::Color>& c(mesh.colors());
+    const Snapshot& a = snapshots[from];
+    const Snapshot& b = snapshots[to];
+    bool blend = blends();
+    for (unsigned i = 0; i < count; i++) {
+      unsigned k = first + i;
+      al::Vec3f p = b.position[k];
+      al::Quatf q = b.orientation[k];
+      if (blend && (p - a.position[k]).magSqr() <= jump * jump) {
+        p = a.position[k] + (p - a.position[k]) * amount;
+        q = al::Quatf::slerp(a.orientation[k], q, amount);
+      }
+      const al::Vec3f& up(q.toVectorY());
+      v[at + i] = p;
+      n[at + i] = -q.toVectorZ();
+      c[at + i].set(up.x, up.y, up.z);
+    }
+  }
+
+  // seconds the playback time is behind the newest state
+  double behind() const { return held > 0 ? newest().time - playback : 0.0; }
+
+  void drawPanel() {
+    if (!ImGui::CollapsingHeader("snapshots")) return;
+    ImGui::Text("%u held, drawn %.1f ms behind the newest", held,
+                behind() * 1e3);
+    ImGui::Text("%lu frames past the newest, %lu resyncs", starved,
+                resynced);
+  }
+
+  // frames drawn with nothing newer to blend towards, and playback jumps
+  unsigned long starved{0}, resynced{0};
+
+ private:
+  const Snapshot& newest() const { return snapshots[head]; }
+  unsigned oldestSlot() const {
+    return (head + CAPACITY + 1 - held) % CAPACITY;
+  }
+
+  Snapshot snapshots[CAPACITY];
+  unsigned head{0};   // slot of the newest
+  unsigned held{0};
+  double playback{0};
+  unsigned from{0}, to{0};  // the states around the playback time
+  float amount{0};          // how far from `from` towards `to`
+};
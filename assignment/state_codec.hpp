@@ -0,0 +1,237 @@
+// MAT201B
+// lossless temporal compression of a stream of states
+//
+// consecutive states differ in few bits: agents move a little per frame,
+// so the high bytes of their fixed-point fields change much less often
+// than the low ones. the encoder XORs each state against the last
+// keyframe, which leaves the unchanged bytes zero, splits the result into
+// byte planes (byte 0 of every record of `stride` bytes, then byte 1, ...)
+// so the zeros of the same field line up into long runs, and writes it as
+// alternating runs of zeros and literal bytes, lengths as varints.
+//
+//   encoder.encode(&state(), state().header.bytes, packet);  // sender
+//   decoder.decode(packet.data(), packet.size(), &state(),   // receiver
+//                  sizeof(state()));
+//
+// every keyframeEvery states the encoder XORs against zeros instead and
+// makes that state the new keyframe. a delta only needs its keyframe, so a
+// lost packet costs that state alone, and a renderer that joins late (or
+// lost a keyframe) starts with the next one. every packet carries a hash
+// of the state it decodes to, and the decoder hands out nothing else: the
+// state a renderer gets is bit-for-bit the one the sender encoded.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+struct CodecHeader {
+  uint32_t sequence;  // states encoded, counting this one
+  uint32_t keyframe;  // sequence of the keyframe this is XORed against;
+                      // its own for a keyframe
+  uint32_t bytes;     // of the state
+  uint32_t packed;    // bytes of runs after the header
+  uint32_t stride;    // bytes per record, one plane per byte of it
+  uint64_t hash;      // of the state
+};
+
+inline uint64_t hashBytes(const uint8_t* data, size_t size) {
+  uint64_t h = 14695981039346656037ull;
+  for (size_t i = 0; i < size; i++) h = (h ^ data[i]) * 1099511628211ull;
+  return h;
+}
+
+namespace codec {
+
+// bytes 0, stride, 2 * stride, ... of the state, then bytes 1, stride + 1,
+// ..., and so on
+inline void toPlanes(const uint8_t* in, size_t size, size_t stride,
+                     uint8_t* out) {
+  size_t at = 0;
+  for (size_t plane = 0; plane < stride; plane++)
+    for (size_t i = plane; i < size; i += stride) out[at++] = in[i];
+}
+
+inline void fromPlanes(const uint8_t* in, size_t size, size_t stride,
+                       uint8_t* out) {
+  size_t at = 0;
+  for (size_t plane = 0; plane < stride; plane++)
+    for (size_t i = plane; i < size; i += stride) out[i] = in[at++];
+}
+
+inline void putVarint(std::vector<uint8_t>& out, size_t v) {
+  while (v >= 0x80) {
+    out.push_back(uint8_t(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back(uint8_t(v));
+}
+
+inline bool getVarint(const uint8_t*& in, const uint8_t* end, size_t& v) {
+  v = 0;
+  for (int shift = 0; in < end && shift < 64; shift += 7) {
+    uint8_t b = *in++;
+    v |= size_t(b & 0x7f) << shift;
+    if (!(b & 0x80)) return true;
+  }
+  return false;
+}
+
+// zeros, then literals, then zeros, ... a run of fewer than MIN_ZEROS
+// zeros between literals costs more than it saves, so it stays literal
+inline void packRuns(const uint8_t* in, size_t size,
+                     std::vector<uint8_t>& out) {
+  enum { MIN_ZEROS = 3 };
+  size_t i = 0;
+  while (i < size) {
+    size_t zeros = 0;
+    while (i + zeros < size && in[i + zeros] == 0) zeros++;
+    i += zeros;
+    size_t end = i;  // of the literals
+    while (end < size) {
+      if (in[end] != 0) {
+        end++;
+        continue;
+      }
+      size_t run = 0;
+      while (end + run < size && in[end + run] == 0) run++;
+      if (run >= MIN_ZEROS || end + run == size) break;
+      end += run;
+    }
+    size_t literals = end - i;
+    putVarint(out, zeros);
+    putVarint(out, literals);
+    out.insert(out.end(), in + i, in + i + literals);
+    i += literals;
+  }
+}
+
+inline bool unpackRuns(const uint8_t* in, const uint8_t* end, uint8_t* out,
+                       size_t size) {
+  size_t i = 0;
+  while (i < size) {
+    size_t zeros, literals;
+    if (!getVarint(in, end, zeros) || !getVarint(in, end, literals))
+      return false;
+    if (zeros > size - i || literals > size - i - zeros ||
+        literals > size_t(end - in))
+      return false;
+    std::memset(out + i, 0, zeros);
+    i += zeros;
+    std::memcpy(out + i, in, literals);
+    in += literals;
+    i += literals;
+  }
+  return in == end;
+}
+
+}  // namespace codec
+
+class StateEncoder {
+ public:
+  unsigned keyframeEvery{10};  // states from one keyframe to the next
+  unsigned stride{4};          // the size of what the state is an array of
+
+  // one packet, header and runs, for the state in `data`
+  void encode(const void* data, size_t size, std::vector<uint8_t>& packet) {
+    const uint8_t* state = static_cast<const uint8_t*>(data);
+    CodecHeader h;
+    h.sequence = ++encoded;
+    bool keyframe = key.empty() || h.sequence - keySequence >= keyframeEvery;
+    if (keyframe) {
+      key.assign(state, state + size);
+      keySequence = h.sequence;
+      keyframes++;
+    }
+    h.keyframe = keySequence;
+    h.bytes = uint32_t(size);
+    h.stride = std::max(1u, stride);
+    h.hash = hashBytes(state, size);
+
+    // a keyframe is XORed against zeros; the key may be shorter or longer
+    // than a state against it, and counts as zeros past its end
+    difference.resize(size);
+    if (keyframe) {
+      std::memcpy(difference.data(), state, size);
+    } else {
+      size_t common = std::min(size, key.size());
+      for (size_t i = 0; i < common; i++) difference[i] = state[i] ^ key[i];
+      std::memcpy(difference.data() + common, state + common, size - common);
+    }
+    planes.resize(size);
+    codec::toPlanes(difference.data(), size, h.stride, planes.data());
+
+    packet.resize(sizeof(CodecHeader));
+    codec::packRuns(planes.data(), size, packet);
+    h.packed = uint32_t(packet.size() - sizeof(CodecHeader));
+    std::memcpy(packet.data(), &h, sizeof(h));
+    rawBytes += size;
+    packedBytes += packet.size();
+  }
+
+  unsigned long encoded{0}, keyframes{0};
+  unsigned long long rawBytes{0}, packedBytes{0};
+
+ private:
+  std::vector<uint8_t> key;
+  uint32_t keySequence{0};
+  std::vector<uint8_t> difference, planes;  // scratch
+};
+
+class StateDecoder {
+ public:
+  enum { MAX_STRIDE = 256 };
+
+  // the state a packet holds, into out (capacity bytes); false, leaving
+  // out alone, if its keyframe never arrived or the packet is damaged
+  bool decode(const void* data, size_t size, void* out, size_t capacity) {
+    const uint8_t* packet = static_cast<const uint8_t*>(data);
+    CodecHeader h;
+    if (size < sizeof(h)) return damaged();
+    std::memcpy(&h, packet, sizeof(h));
+    if (h.packed != size - sizeof(h) || h.bytes > capacity ||
+        h.stride == 0 || h.stride > MAX_STRIDE)
+      return damaged();
+    bool keyframe = h.keyframe == h.sequence;
+    if (!keyframe && (key.empty() || h.keyframe != keySequence)) {
+      unkeyed++;
+      return false;
+    }
+
+    planes.resize(h.bytes);
+    if (!codec::unpackRuns(packet + sizeof(h), packet + size, planes.data(),
+                           h.bytes))
+      return damaged();
+    state.resize(h.bytes);
+    codec::fromPlanes(planes.data(), h.bytes, h.stride, state.data());
+    if (!keyframe) {
+      size_t common = std::min(state.size(), key.size());
+      for (size_t i = 0; i < common; i++) state[i] ^= key[i];
+    }
+    if (hashBytes(state.data(), state.size()) != h.hash) return damaged();
+
+    if (keyframe) {
+      key = state;
+      keySequence = h.sequence;
+    }
+    std::memcpy(out, state.data(), state.size());
+    decoded++;
+    return true;
+  }
+
+  // states handed out, packets waiting on a keyframe, and bad packets
+  unsigned long decoded{0}, unkeyed{0}, corrupt{0};
+
+ private:
+  bool damaged() {
+    corrupt++;
+    return false;
+  }
+
+  std::vector<uint8_t> key;
+  uint32_t keySequence{0};
+  std::vector<uint8_t> planes, state;  // scratch
+};
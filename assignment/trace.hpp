@@ -0,0 +1,144 @@
+// MAT201B
+// ring-buffered timeline of what each thread did, written out in the
+// Chrome trace format (open in chrome://tracing or ui.perfetto.dev)
+//
+//   { TraceScope scope(trace, "draw"); ... }   // from any thread
+//   trace.nameThread("audio");                 // optional, once per thread
+//   trace.writeJSON("trace.json");
+//
+// recording is a relaxed fetch_add and a few stores, so it can stay on
+// during a show; the buffer keeps the newest events and overwrites the
+// oldest. names must outlive the recorder: string literals, or names
+// that may go away before it (a rebuilt StageGraph's) passed through
+// intern(), which keeps a copy for as long as the recorder lives.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+class TraceRecorder {
+ public:
+  enum { CAPACITY = 1 << 16 };  // events kept, a power of two
+
+  TraceRecorder()
+      : origin(std::chrono::steady_clock::now()), events(CAPACITY) {}
+
+  std::atomic<bool> enabled{true};
+
+  // microseconds since the recorder was made
+  int64_t now() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - origin)
+        .count();
+  }
+
+  // a small id per thread, shared by every recorder
+  static uint32_t threadId() {
+    static std::atomic<uint32_t> nextId{1};
+    thread_local uint32_t id = nextId++;
+    return id;
+  }
+
+  // one complete span on the calling thread
+  void record(const char* name, int64_t begin, int64_t end) {
+    if (!enabled.load(std::memory_order_relaxed)) return;
+    uint64_t n = written.fetch_add(1, std::memory_order_relaxed);
+    Event& e = events[n & (CAPACITY - 1)];
+    // a writer marks the slot busy, so a dump never prints half an event
+    e.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    e.name.store(name, std::memory_order_relaxed);
+    e.thread.store(threadId(), std::memory_order_relaxed);
+    e.begin.store(begin, std::memory_order_relaxed);
+    e.duration.store(end - begin, std::memory_order_relaxed);
+    e.sequence.store(n + 1, std::memory_order_release);
+  }
+
+  // a copy of name that lives as long as the recorder; the same name
+  // always gives the same pointer
+  const char* intern(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return names.insert(name).first->c_str();
+  }
+
+  void nameThread(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    threadNames.push_back(std::make_pair(threadId(), name));
+  }
+
+  bool writeJSON(const char* fileName) {
+    FILE* file = fopen(fileName, "w");
+    if (!file) return false;
+    fprintf(file, "{\"traceEvents\":[\n");
+    bool first = true;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (auto& t : threadNames) {
+        fprintf(file,
+                "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                "\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", t.first, t.second.c_str());
+        first = false;
+      }
+    }
+    uint64_t end = written.load(std::memory_order_acquire);
+    uint64_t start = end > CAPACITY ? end - CAPACITY : 0;
+    for (uint64_t n = start; n < end; n++) {
+      Event& e = events[n & (CAPACITY - 1)];
+      if (e.sequence.load(std::memory_order_acquire) != n + 1) continue;
+      const char* name = e.name.load(std::memory_order_relaxed);
+      uint32_t thread = e.thread.load(std::memory_order_relaxed);
+      int64_t begin = e.begin.load(std::memory_order_relaxed);
+      int64_t duration = e.duration.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (e.sequence.load(std::memory_order_relaxed) != n + 1) continue;
+      fprintf(file,
+              "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+              "\"ts\":%lld,\"dur\":%lld}",
+              first ? "" : ",\n", name, thread, (long long)begin,
+              (long long)duration);
+      first = false;
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return true;
+  }
+
+ private:
+  struct Event {
+    // n + 1 once event n is complete; the fields are atomics only so a
+    // dump racing a writer is well defined
+    std::atomic<uint64_t> sequence{0};
+    std::atomic<const char*> name{nullptr};
+    std::atomic<uint32_t> thread{0};
+    std::atomic<int64_t> begin{0};
+    std::atomic<int64_t> duration{0};
+  };
+
+  std::chrono::steady_clock::time_point origin;
+  std::vector<Event> events;
+  std::atomic<uint64_t> written{0};
+  std::mutex mutex;
+  std::vector<std::pair<uint32_t, std::string>> threadNames;
+  std::set<std::string> names;  // from intern()
+};
+
+// records the span from construction to destruction
+class TraceScope {
+ public:
+  TraceScope(TraceRecorder& trace, const char* name)
+      : trace(trace), name(name), begin(trace.now()) {}
+  ~TraceScope() { trace.record(name, begin, trace.now()); }
+
+ private:
+  TraceRecorder& trace;
+  const char* name;
+  int64_t begin;
+};
@@ -0,0 +1,105 @@
+// MAT201B
+// compact per-agent pose for SharedState
+//
+// a raw position/forward/up triple is 36 bytes; PackedPose is 10:
+// position as 16-bit fixed point inside known world bounds, orientation as
+// a "smallest three" quaternion (2 bits for the dropped component, 10 bits
+// for each of the other three). forward and up are rebuilt on receivers.
+
+#pragma once
+
+#include "al/math/al_Quat.hpp"
+#include "al/math/al_Vec.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+struct PackedPose {
+  uint16_t position[3];
+  uint16_t orientation[2];
+};
+
+// the cube positions are quantized in; anything outside is clamped
+struct WorldBounds {
+  float lo{-1.5f};
+  float hi{1.5f};
+};
+
+inline uint16_t quantize(float v, float lo, float hi) {
+  float t = (v - lo) / (hi - lo);
+  t = std::min(1.0f, std::max(0.0f, t));
+  return uint16_t(t * 65535.0f + 0.5f);
+}
+
+inline float dequantize(uint16_t q, float lo, float hi) {
+  return lo + (hi - lo) * (q / 65535.0f);
+}
+
+inline void encodePosition(const al::Vec3f& p, const WorldBounds& b,
+                           uint16_t out[3]) {
+  for (int i = 0; i < 3; i++) out[i] = quantize(p[i], b.lo, b.hi);
+}
+
+inline al::Vec3f decodePosition(const uint16_t in[3], const WorldBounds& b) {
+  return al::Vec3f(dequantize(in[0], b.lo, b.hi), dequantize(in[1], b.lo, b.hi),
+                   dequantize(in[2], b.lo, b.hi));
+}
+
+// q and -q are the same rotation, so the largest component can be made
+// positive and left out; the rest are within +-1/sqrt(2)
+inline uint32_t encodeOrientation(const al::Quatf& q) {
+  const float range = 0.70710678f;
+  float c[4] = {q.w, q.x, q.y, q.z};
+  int largest = 0;
+  for (int i = 1; i < 4; i++)
+    if (std::abs(c[i]) > std::abs(c[largest])) largest = i;
+  float sign = c[largest] < 0 ? -1.0f : 1.0f;
+  uint32_t bits = uint32_t(largest) << 30;
+  int shift = 20;
+  for (int i = 0; i < 4; i++) {
+    if (i == largest) continue;
+    float t = (c[i] * sign + range) / (2 * range);
+    t = std::min(1.0f, std::max(0.0f, t));
+    bits |= uint32_t(t * 1023.0f + 0.5f) << shift;
+    shift -= 10;
+  }
+  return bits;
+}
+
+inline al::Quatf decodeOrientation(uint32_t bits) {
+  const float range = 0.70710678f;
+  int largest = int(bits >> 30);
+  float c[4];
+  float sum = 0;
+  int shift = 20;
+  for (int i = 0; i < 4; i++) {
+    if (i == largest) continue;
+    c[i] = ((bits >> shift) & 1023) / 1023.0f * (2 * range) - range;
+    sum += c[i] * c[i];
+    shift -= 10;
+  }
+  c[largest] = std::sqrt(std::max(0.0f, 1 - sum));
+  al::Quatf q(c[0], c[1], c[2], c[3]);
+  return q.normalize();
+}
+
+inline PackedPose packPose(const al::Vec3f& position,
+                           const al::Quatf& orientation,
+                           const WorldBounds& bounds) {
+  PackedPose p;
+  encodePosition(position, bounds, p.position);
+  uint32_t o = encodeOrientation(orientation);
+  p.orientation[0] = uint16_t(o >> 16);
+  p.orientation[1] = uint16_t(o & 0xffff);
+  return p;
+}
+
+inline al::Vec3f unpackPosition(const PackedPose& p, const WorldBounds& b) {
+  return decodePosition(p.position, b);
+}
+
+inline al::Quatf unpackOrientation(const PackedPose& p) {
+  return decodeOrientation(uint32_t(p.orientation[0]) << 16 |
+                           p.orientation[1]);
+}